@@ -0,0 +1,158 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <future>
+#include <atomic>
+#include <cstdint>
+
+#include <threadable.h>
+#include <connectors.h>
+#include <exchange.h>
+
+using namespace std;
+
+// Columns of a capture segment. Events and input orders share the layout,
+// the type is the EventType or the OrderType, displayQty is 0 for events,
+// orderId is UINT64_MAX for inputs.
+// The rows are in seq order. For inputs seq and time are the engine's input
+// sequence and the time it took the order, a gap in seq means inputs lost to
+// a full ring (see Capture::dropped). For events seq counts the events the
+// Notifier handed to the capture, a gap means events lost to a full ring,
+// and time is the wall clock (ns) when the capture thread took the batch,
+// it is only non decreasing.
+enum CaptureColumn {SeqColumn, TimeColumn, TypeColumn, InstrumentColumn, TraderColumn, QtyColumn, SideColumn, DisplayQtyColumn, OrderIdColumn, COLUMNS};
+
+enum CaptureKind : uint32_t {EventsCapture, InputsCapture};
+
+// First page of a segment file, the columns follow at the given offsets,
+// each one `capacity` fixed width values (see columnWidth).
+struct SegmentHeader
+{
+  enum {SIZE = 4096};
+
+  char magic[8];
+  uint32_t kind;
+  uint32_t columns;
+  uint64_t capacity;
+  uint64_t rows;     // updated after every batch, release store (see commit)
+  uint64_t firstSeq;
+  uint64_t offsets[COLUMNS];
+};
+
+size_t columnWidth(CaptureColumn column);
+
+// Writes one kind of records to pre-allocated, mmap'd segment files
+// dir/name-000001.cap, dir/name-000002.cap, ... rolling to the next one when
+// `capacity` rows are written. The pages are populated up front, so the
+// capture thread does not fault while writing, and the next segment is
+// allocated on a helper thread once the current one is half full, so a roll
+// only swaps the mappings. Throws system_error when a file cannot be set up.
+struct SegmentWriter
+{
+  SegmentWriter(const string& dir, const string& name, CaptureKind kind, uint64_t capacity);
+
+  ~SegmentWriter();
+
+  SegmentWriter(const SegmentWriter&) = delete;
+  SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+  void append(uint64_t seq, uint64_t time, uint8_t type, char instrument, uint16_t trader, uint64_t qty, uint8_t side, uint32_t displayQty, uint64_t orderId);
+
+  // publishes the rows written so far in the header, the rows before the
+  // count are visible to a reader that loads it with acquire (SegmentReader)
+  void commit();
+
+  void close();
+
+  void open();
+
+  // creates, sizes and maps the file of the segment, header filled in;
+  // the file is removed again when that fails
+  uint8_t* allocate(uint32_t segment) const;
+
+  string dir, name;
+  CaptureKind kind;
+  uint64_t capacity;
+  uint32_t segment;
+  uint64_t rows;
+  size_t bytes;
+  uint8_t* base;
+  uint8_t* column[COLUMNS];
+  future<uint8_t*> next;
+};
+
+// Capture stage: records every input order in the order the engine takes
+// them and every event the engine generates. The engine and the Notifier
+// only try to push to the rings, they never wait for the capture thread: a
+// record that finds its ring full is counted in `dropped`. The files are
+// written on the capture thread. When a segment cannot be written (disk
+// full, ...) the capture gives up without disturbing the exchange: `failed`
+// is set, `error` tells why (read it after `failed`) and the records are
+// only counted in `dropped` from then on.
+struct Capture final : public threadable
+{
+  Capture(const string& dir, uint64_t segmentRows = 1 << 20);
+
+  // stops the thread before the writers it uses are gone
+  ~Capture();
+
+  // taps the input orders of the engine and the events of the Notifier,
+  // before the exchange starts
+  void attach(Exchange& ex);
+
+  virtual void run();
+
+  SingleProducerSingleConsumerQueue<SequencedEvent> events;
+  SingleProducerSingleConsumerQueue<SequencedInput> inputs;
+  SegmentWriter eventsWriter, inputsWriter;
+  uint64_t eventsSeq, inputsSeq; // last seq written
+  atomic<bool> failed;
+  atomic<uint64_t> dropped;
+  string error;
+};
+
+// Selects the rows where all the set fields match, -1 - any.
+struct CaptureFilter
+{
+  int instrument = -1;
+  int trader = -1;
+  int type = -1;
+};
+
+// Read only view of one segment file. The filters scan the columns with the
+// filterU8/filterU16 kernels selected at startup (see scan.h). open() rejects
+// a file whose header does not fit its size.
+struct SegmentReader
+{
+  SegmentReader();
+
+  ~SegmentReader();
+
+  SegmentReader(const SegmentReader&) = delete;
+  SegmentReader& operator=(const SegmentReader&) = delete;
+
+  bool open(const string& path);
+
+  void close();
+
+  // rows committed so far, the writer may still be appending
+  uint64_t rows() const { return __atomic_load_n(&header->rows, __ATOMIC_ACQUIRE); }
+
+  template <typename T>
+  const T* data(CaptureColumn column) const { return reinterpret_cast<const T*>(base + header->offsets[column]); }
+
+  // indexes of the matching rows, in order
+  size_t select(const CaptureFilter& filter, vector<uint64_t>& out) const;
+
+  Event event(size_t row) const;
+
+  InputOrder input(size_t row) const;
+
+  const SegmentHeader* header;
+  const uint8_t* base;
+  size_t bytes;
+};
+
+// segment files of one kind in dir, in order
+vector<string> captureSegments(const string& dir, const string& name);
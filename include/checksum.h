@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// CRC-32C (Castagnoli) for journal and wire records. Call with crc = 0, or
+// with the result of the previous call to continue a checksum.
+using Crc32cKernel = uint32_t (*)(uint32_t crc, const void* data, size_t len);
+
+uint32_t crc32cGeneric(uint32_t crc, const void* data, size_t len);
+
+uint32_t crc32cSse42(uint32_t crc, const void* data, size_t len);
+
+// selected at startup, see cpu.h
+extern Crc32cKernel crc32c;
@@ -5,6 +5,8 @@
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <algorithm>
+#include <cstdint>
 using namespace std;
 
 template <typename T>
@@ -12,10 +14,17 @@ struct MultiProducerMultiConsumerQueue
 {
   MultiProducerMultiConsumerQueue();
 
+  // no more pushes accepted, the queued items can still be popped
+  void close();
+
+  // closes and wakes up the consumers, pop returns false once it's drained
   void stop();
 
-  bool empty();
+  // lock-free hint, exact for the consumer that popped last
+  bool empty() const;
 
+  // nodiscard: false once closed, the item was not queued; an order refused
+  // at shutdown gets no event, the caller has to account for it
   bool push(const T& x);
 
   bool pop(T& x);
@@ -23,10 +32,40 @@ struct MultiProducerMultiConsumerQueue
   mutex m;
   condition_variable cv;
   queue<T> q;
+  atomic<size_t> count; // q.size(), written under m
+  bool isClosed;
   bool isShutdown;
 };
 
 
+// Lets the consumers of lock-free rings sleep when all their rings are
+// empty (an event count). A consumer announces itself with prepare(), looks
+// at its rings once more and then waits for the rings counter to move; a
+// producer calls ring() after pushing. A producer pays one fence and one
+// load when nobody sleeps.
+struct Doorbell
+{
+  Doorbell() : sleepers(0), rings(0) {}
+
+  uint64_t prepare();
+
+  // the rings were not empty after all
+  void cancel();
+
+  // until somebody rings or stop is set (see wakeAll)
+  void wait(uint64_t seen, const atomic<bool>& stop);
+
+  void ring();
+
+  // wakes up everybody, for the shutdown
+  void wakeAll();
+
+  mutex m;
+  condition_variable cv;
+  atomic<uint32_t> sleepers;
+  atomic<uint64_t> rings;
+};
+
 template <typename T, int SIZE=(1<<16)>
 struct SingleProducerSingleConsumerQueue 
 {
@@ -40,12 +79,54 @@ struct SingleProducerSingleConsumerQueue
 
   bool pop(T& x);
 
+  // pops up to max items with at most two block copies
+  size_t pop(T* x, size_t max);
+
   atomic<size_t> head, tail;
   T buffer[SIZE];
 };
 
 
 
+inline uint64_t Doorbell::prepare()
+{
+  // pairs with the fence of ring(): either the producer sees the sleeper,
+  // or the sleeper sees what was pushed before
+  sleepers.fetch_add(1, memory_order_seq_cst);
+  atomic_thread_fence(memory_order_seq_cst);
+  return rings.load(memory_order_relaxed);
+}
+
+inline void Doorbell::cancel()
+{
+  sleepers.fetch_sub(1, memory_order_relaxed);
+}
+
+inline void Doorbell::wait(uint64_t seen, const atomic<bool>& stop)
+{
+  {
+    unique_lock<mutex> lm(m);
+    cv.wait(lm, [&](){ return seen != rings.load(memory_order_relaxed) || true == stop.load(memory_order_acquire); });
+  }
+  sleepers.fetch_sub(1, memory_order_relaxed);
+}
+
+inline void Doorbell::ring()
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  if (0 == sleepers.load(memory_order_relaxed)) return;
+  wakeAll();
+}
+
+inline void Doorbell::wakeAll()
+{
+  {
+    unique_lock<mutex> lm(m);
+    rings.fetch_add(1, memory_order_relaxed);
+  }
+  cv.notify_all();
+}
+
 template <typename T, int SIZE>
 SingleProducerSingleConsumerQueue<T,SIZE>::SingleProducerSingleConsumerQueue() : head(0), tail(0) {} 
 
@@ -93,18 +174,45 @@ bool SingleProducerSingleConsumerQueue<T,SIZE>::pop(T& x)
   return true;
 }
 
+template <typename T, int SIZE>
+size_t SingleProducerSingleConsumerQueue<T,SIZE>::pop(T* x, size_t max) 
+{
+  size_t current_tail = tail.load(memory_order_relaxed);
+  size_t n = min(head.load(memory_order_acquire) - current_tail, max);
+  if (0 == n)
+  {
+    return 0;
+  }
+
+  size_t at = current_tail % SIZE;
+  size_t first = min(n, SIZE - at);
+  copy(buffer + at, buffer + at + first, x);
+  copy(buffer, buffer + (n - first), x + first);
+  tail.store(current_tail+n, memory_order_release);
+  return n;
+}
+
 template <typename T>
-MultiProducerMultiConsumerQueue<T>::MultiProducerMultiConsumerQueue() : isShutdown(false) {} 
+MultiProducerMultiConsumerQueue<T>::MultiProducerMultiConsumerQueue() : count(0), isClosed(false), isShutdown(false) {} 
 
 template <typename T>
-bool MultiProducerMultiConsumerQueue<T>::empty() 
+bool MultiProducerMultiConsumerQueue<T>::empty() const
 {
-  return q.empty();
+  return 0 == count.load(memory_order_relaxed);
+}
+
+template <typename T>
+void MultiProducerMultiConsumerQueue<T>::close() 
+{
+  unique_lock<mutex> lm(m);
+  isClosed = true;
 }
 
 template <typename T>
 void MultiProducerMultiConsumerQueue<T>::stop() 
 {
+  unique_lock<mutex> lm(m);
+  isClosed = true;
   isShutdown = true;
   cv.notify_all();
 }
@@ -113,7 +221,9 @@ template <typename T>
 bool MultiProducerMultiConsumerQueue<T>::push(const T& x) 
 {
   unique_lock<mutex> lm(m);
+  if (true == isClosed) return false;
   q.push(x);
+  count.store(q.size(), memory_order_relaxed);
   cv.notify_one();
   return true;
 }
@@ -124,10 +234,11 @@ bool MultiProducerMultiConsumerQueue<T>::pop(T& x)
   unique_lock<mutex> lm(m);
   cv.wait(lm, [&](){ return (false == q.empty()) || (true == isShutdown); });
 
-  if (true == isShutdown) return false;
+  if (true == q.empty()) return false;
 
   x = q.front();
   q.pop();
+  count.store(q.size(), memory_order_relaxed);
   return true;
 }
 
@@ -0,0 +1,22 @@
+#pragma once
+using namespace std;
+
+// Instruction sets the hot kernels are built for. The rest of the code is
+// built for the portable baseline, the kernels are selected at runtime.
+// The ring copies are not dispatched here, they go through memcpy.
+enum Isa {Generic, Sse42, Avx2, Avx512};
+
+// the best isa supported by this cpu (and the OS)
+Isa cpuIsa();
+
+bool cpuSupports(Isa isa);
+
+const char* isaName(Isa isa);
+
+// Selects the kernels (sweepOrders, crc32c, filterU8, filterU16) built for
+// isa, lowered to what the cpu supports. Called at startup with EXENGINE_ISA=
+// generic|sse42|avx2|avx512 or the best isa of the cpu. Not thread safe,
+// meant for startup and benchmarks. Returns the selected isa.
+Isa dispatchKernels(Isa isa);
+
+Isa activeIsa();
@@ -2,46 +2,141 @@
 
 #include <unordered_map>
 #include <deque>
+#include <vector>
 #include <thread>
+#include <chrono>
+#include <atomic>
 #include <utility>
+#include <algorithm>
+#include <iostream>
 
 #include <threadable.h>
 #include <connectors.h>
+#include <risk.h>
+#include <sweep.h>
 
 using namespace std;
 
 enum Side {Buy, Sell, None};
-enum EventType {OrderPlaced, Exec, Tick};
+enum EventType {OrderPlaced, Exec, Tick, QueuePosition, Rejected, Cancelled};
+enum OrderType {Regular, ImmediateOrCancel, FillOrKill, Iceberg};
+// EveryOrder - a Tick after every order (default), Coalesced - instruments
+// are marked dirty and get one Tick at flushTicks, NoTicks - for backtesting.
+enum TickMode {EveryOrder, Coalesced, NoTicks};
 
+// qty is the quantity reported in the Exec event. The remaining quantity is
+// kept apart in OrderQueue. For icebergs remaining is the displayed slice,
+// refreshed from the hidden reserve by display quantity.
 struct InternalOrder 
 {
-  InternalOrder(uint16_t trd, uint16_t qt) : trader(trd), qty(qt) {}
+  InternalOrder(uint16_t trd, uint32_t qt, uint32_t disp = 0, uint32_t rsv = 0) : qty(qt), display(disp), reserve(rsv), trader(trd) {}
+  uint32_t qty;
+  uint32_t display;
+  uint32_t reserve;
   uint16_t trader;
-  uint16_t qty;
+};
+
+// Resting orders in time priority as structure of arrays: the remaining
+// quantities are contiguous, so a sweep of many orders is a single scan
+// (see sweep.h). Executed orders are dropped from the front by moving head,
+// the space is reclaimed in bulk. 20 bytes per order. The id of an order is
+// its number in the queue since it was created (firstId + i), so it needs
+// no storage of its own.
+struct OrderQueue
+{
+  OrderQueue() : head(0), firstId(0) {}
+
+  bool empty() const { return head == remaining.size(); }
+
+  size_t size() const { return remaining.size() - head; }
+
+  InternalOrder& order(size_t i) { return orders[head + i]; }
+
+  const InternalOrder& order(size_t i) const { return orders[head + i]; }
+
+  uint32_t& remainingQty(size_t i) { return remaining[head + i]; }
+
+  uint32_t remainingQty(size_t i) const { return remaining[head + i]; }
+
+  const uint32_t* remainingData() const { return remaining.data() + head; }
+
+  uint64_t id(size_t i) const { return firstId + i; }
+
+  // index of a resting order by id
+  bool find(uint64_t id, size_t& i) const;
+
+  // the quantity queued in front of the order at i
+  uint64_t qtyAhead(size_t i) const;
+
+  void push(uint16_t trader, uint32_t qty, uint32_t rem, uint32_t display = 0, uint32_t reserve = 0);
+
+  void pop(size_t n);
+
+  enum {RECLAIM = 4096};
+
+  vector<uint32_t> remaining;
+  vector<InternalOrder> orders;
+  size_t head;
+  uint64_t firstId;
 };
 
 struct InputOrder 
 {
   char instrument;
   uint16_t trader;
-  uint16_t qty;
+  uint32_t qty;
   Side side;
+  OrderType type = Regular;
+  uint32_t displayQty = 0;
   bool operator==(const InputOrder& rhs)
   { 
     return instrument == rhs.instrument &&
            trader == rhs.trader &&
            qty == rhs.qty && 
-           side == rhs.side;
+           side == rhs.side &&
+           type == rhs.type &&
+           displayQty == rhs.displayQty;
   }
 };
 
+// An input order as the engine took it: seq is the input sequence of the
+// engine (1, 2, ...), time the wall clock (ns) when it was taken.
+struct SequencedInput
+{
+  uint64_t seq;
+  uint64_t time;
+  InputOrder order;
+};
+
+// Where the engine copies every input order before matching it (see
+// capture.h, replica.h). The engine does not wait for an asynchronous tap:
+// when the ring is full the input is counted in `dropped`, the reader sees a
+// gap in the seq. A synchronous tap (acked set) holds up the matching, and
+// so the events, of a batch of inputs until `acked` reaches the seq of the
+// last one, for as long as `live` is true; the batches the engine waited
+// for (a full ring, the ack) and the time it waited are counted in `held`
+// and `heldNs`.
+struct InputTap
+{
+  SingleProducerSingleConsumerQueue<SequencedInput>* ring;
+  atomic<uint64_t>* dropped;
+  const atomic<uint64_t>* acked = nullptr;
+  const atomic<bool>* live = nullptr;
+  atomic<uint64_t>* held = nullptr;
+  atomic<uint64_t>* heldNs = nullptr;
+};
+
+// orderId is the id of the resting order the event is about (OrderPlaced,
+// QueuePosition, Exec of a resting order), UINT64_MAX for the others. It is
+// not compared by ==.
 struct Event 
 {
   EventType type;
   char instrument;
   uint16_t trader;
-  uint32_t qty;
+  uint64_t qty;
   Side side;
+  uint64_t orderId = UINT64_MAX;
 
   bool operator==(const Event& rhs)
   { 
@@ -53,13 +148,85 @@ struct Event
   }
 };
 
+// An event as the Notifier handed it to the capture: seq counts every event
+// (1, 2, ...), the ones lost to a full capture ring too.
+struct SequencedEvent
+{
+  uint64_t seq;
+  Event event;
+};
+
+// dequeuedQty is all the quantity executed out of the queue since the book
+// was created. Nothing leaves the queue but by execution, so an order that
+// rests with qtyAhead in front of it is at the front once dequeuedQty reaches
+// its queue mark (dequeuedQty + qtyAhead when it rested).
 struct Book 
 {
-  Book() : actualSide(None), outstandingQty(0), openedOrdersQty(0) {}
+  Book() : actualSide(None), outstandingQty(0), openedOrdersQty(0), hiddenQty(0), dequeuedQty(0) {}
 
-  uint32_t outstandingQty, openedOrdersQty;
+  uint64_t outstandingQty, openedOrdersQty, hiddenQty, dequeuedQty;
   Side actualSide;
-  deque<InternalOrder> orders;
+  OrderQueue orders;
+};
+
+// One resting order as seen by market-by-order readers. qtyAhead is the
+// quantity queued in front of it (its queue position).
+struct RestingOrder
+{
+  uint16_t trader;
+  uint32_t qty;
+  uint64_t qtyAhead;
+};
+
+// Copy of the top of one order book. The queue position of any resting
+// order, at any depth, is its queue mark - dequeuedQty (see Book). Orders
+// leave only from the front, so an order rests while its id is in
+// [firstId, firstId + ordersCount).
+struct BookDepth
+{
+  enum {MAX_ORDERS = 8};
+
+  Side side;
+  uint64_t outstandingQty;
+  uint64_t dequeuedQty;
+  uint64_t firstId; // of the front order
+  uint32_t ordersCount;
+  uint32_t size;
+  RestingOrder orders[MAX_ORDERS];
+};
+
+// Seqlock protected BookDepth. Written only by the engine thread, readers
+// on other threads retry instead of blocking the writer.
+struct BookSnapshot
+{
+  BookSnapshot();
+
+  bool read(BookDepth& depth) const;
+
+  atomic<uint32_t> seq;
+  BookDepth depth;
+};
+
+// Market view policies. Called by the engine after every book update.
+struct NoMarketView
+{
+  template <typename BookT>
+  void publish(char, const BookT&) {}
+};
+
+// Off until enabled (before the exchange starts): the engine pays for the
+// copy of the top orders and the seqlock write only when somebody reads.
+struct DepthSnapshots
+{
+  DepthSnapshots() : enabled(false) {}
+
+  template <typename BookT>
+  void publish(char instrument, const BookT& book);
+
+  bool read(char instrument, BookDepth& depth) const;
+
+  bool enabled;
+  BookSnapshot snapshots[256];
 };
 
 struct Notifier : public threadable
@@ -72,36 +239,531 @@ struct Notifier : public threadable
 
   SingleProducerSingleConsumerQueue<Event> events;
   unordered_map<uint16_t, SingleProducerSingleConsumerQueue<Event>*> clients;
+  SingleProducerSingleConsumerQueue<SequencedEvent>* capture; // every event, see capture.h
+  atomic<uint64_t>* captureDropped;                  // events lost to a full capture ring
+  uint64_t captureSeq;                               // last event handed to the capture
+  Doorbell doorbell;                                 // rung after delivering to the clients, see scheduler.h
+  bool ringing;                                      // a scheduler parks on the doorbell, set before start
+};
+
+// Event sink policies. The engine hands every generated event to its sink.
+// NotifierSink is the production path (events ring consumed by Notifier),
+// CallbackSink lets backtests consume events inline on the engine thread.
+// A discarding NotifierSink drops the events: nobody consumes the ring of a
+// standby that is not promoted yet (see replica.h).
+struct NotifierSink
+{
+  NotifierSink(Notifier& notifier) : notify(notifier), discard(false) {}
+
+  void operator()(const Event& event);
+
+  Notifier& notify;
+  bool discard;
+};
+
+template <typename F>
+struct CallbackSink
+{
+  CallbackSink(F f) : callback(f) {}
+
+  void operator()(const Event& event) { callback(event); }
+
+  F callback;
+};
+
+struct NullSink
+{
+  void operator()(const Event&) {}
+};
+
+// Instrumentation policies. Called for every order taken and every event
+// generated, empty by default so the calls are compiled out.
+struct NoInstrumentation
+{
+  void onOrder() {}
+  void onEvent(const Event&) {}
+};
+
+struct CountingInstrumentation
+{
+  CountingInstrumentation() : orders(0), events(0) {}
+
+  void onOrder() { orders++; }
+  void onEvent(const Event&) { events++; }
+
+  uint64_t orders, events;
+};
+
+// Ingress policy for engines driven only by direct placeOrder calls.
+struct NoIngress
+{
+  bool pop(InputOrder&) { return false; }
+  bool empty() { return true; }
+  void stop() {}
 };
 
-struct Engine : public threadable 
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView = NoMarketView, typename Risk = NoRisk>
+struct BasicEngine : public threadable 
 {
-  Engine(Notifier& notifier);
+  BasicEngine(Sink s);
+
+  enum : uint64_t {NO_ORDER = UINT64_MAX};
 
-  void placeOrder(char instrument, Side side, uint16_t trader, uint16_t qty);
+  // the id of the order in the book of the instrument while it rests,
+  // NO_ORDER when it did not rest
+  uint64_t placeOrder(char instrument, Side side, uint16_t trader, uint32_t qty, OrderType type = Regular, uint32_t displayQty = 0);
+
+  // quantity ahead of a resting order, on the engine thread (other threads
+  // use the queue mark, see Exchange::queuePosition)
+  bool queuePosition(char instrument, uint64_t order, uint64_t& qtyAhead) const;
+
+  // OrderPlaced (and QueuePosition) of an order that starts resting
+  void publishResting(char instrument, const BookT& book, uint16_t trader, uint64_t qty, Side side, uint64_t order, uint64_t qtyAhead);
 
   void stop();
 
   virtual void run();
 
-  Notifier& notify;
-  unordered_map<char, Book> books;
-  MultiProducerMultiConsumerQueue<InputOrder> q;
+  // copies the inputs to the taps, waits for the synchronous ones; returns
+  // the time the inputs were taken at (0 - no taps)
+  uint64_t tapInputs(const InputOrder* inputs, size_t n);
+
+  void publish(const Event& event);
+
+  // one Tick per instrument changed since the last flush (Coalesced mode),
+  // run() flushes when the ingress queue runs empty
+  void flushTicks();
+
+  void tick(char instrument, const BookT& book);
+
+  Sink sink;
+  Instrumentation instrumentation;
+  MarketView marketView;
+  Risk risk;
+  unordered_map<char, BookT> books;
+  Ingress q;
+  bool queuePositionEvents;    // a QueuePosition event (the queue mark) with every OrderPlaced
+  vector<InputTap> inputTaps;  // inputs in matching order, see capture.h, replica.h
+  uint64_t inputSeq;           // inputs taken by run()
+  uint64_t inputTime;          // wall clock (ns) the order being matched was taken at, 0 - now (see PreTradeRisk::admit)
+  TickMode tickMode;
+  uint32_t tickInterval;       // Coalesced: flush after that many orders too, 0 - off
+  uint32_t ordersSinceFlush;
+  uint16_t dirtyCount;
+  char dirtyInstruments[256];
+  bool dirty[256];
 };
 
+using Engine = BasicEngine<Book, NotifierSink, NoInstrumentation, MultiProducerMultiConsumerQueue<InputOrder>, DepthSnapshots, PreTradeRisk>;
+
+template <typename BookT, typename F>
+using BacktestEngine = BasicEngine<BookT, CallbackSink<F>, NoInstrumentation, NoIngress>;
+
 struct TradingTool;
 struct Exchange 
 {
   Exchange() : engine(notif) {}
 
+  ~Exchange();
+
   void registerClient(uint16_t id, TradingTool* client);
 
+  // false until engine.marketView.enabled is set (before start) and the
+  // book of the instrument was updated
+  bool depth(char instrument, BookDepth& out) const;
+
+  // net position and traded volume, lock-free, from any thread
+  Position position(char instrument, uint16_t trader) const;
+
+  // quantity ahead of the resting order with the id and the queue mark of
+  // its QueuePosition event, lock-free, from any thread; false when the
+  // order does not rest (any more) or there is no depth snapshot
+  bool queuePosition(char instrument, uint64_t order, uint64_t mark, uint64_t& qtyAhead) const;
+
   void start();
 
+  // stops accepting new orders, the orders already queued are still matched
+  void close();
+
+  // Ordered drain: closes the gateway, lets the Engine match all the queued
+  // orders, lets the Notifier deliver all the events to the clients rings,
+  // then stops both. Nothing accepted before is lost. Clients should keep
+  // consuming (or have big enough rings) until stop returns.
   void stop();
 
+  // stop() for a client that no longer reads its ring: what the Notifier
+  // still delivers to `unread` is popped and dropped until stop returns, a
+  // full ring would keep the Notifier (and stop) waiting
+  void stopDiscarding(SingleProducerSingleConsumerQueue<Event>& unread);
+
   Notifier notif;
   Engine engine;
 };
 
 
+
+inline void OrderQueue::push(uint16_t trader, uint32_t qty, uint32_t rem, uint32_t display, uint32_t reserve)
+{
+  remaining.push_back(rem);
+  orders.emplace_back(trader, qty, display, reserve);
+}
+
+inline bool OrderQueue::find(uint64_t id, size_t& i) const
+{
+  if (id < firstId || id - firstId >= size()) return false;
+  i = id - firstId;
+  return true;
+}
+
+inline uint64_t OrderQueue::qtyAhead(size_t i) const
+{
+  uint64_t qty = 0;
+  for (const uint32_t* p = remainingData(), *end = p + i; p != end; p++) qty += *p;
+  return qty;
+}
+
+inline void OrderQueue::pop(size_t n)
+{
+  head += n;
+  firstId += n;
+  if (head == remaining.size())
+  {
+    remaining.clear();
+    orders.clear();
+    head = 0;
+  }
+  else if (head >= RECLAIM && 2 * head >= remaining.size())
+  {
+    remaining.erase(remaining.begin(), remaining.begin() + head);
+    orders.erase(orders.begin(), orders.begin() + head);
+    head = 0;
+  }
+}
+
+inline void NotifierSink::operator()(const Event& event)
+{
+  if (true == discard) return;
+  if (false == notify.events.push(event))
+  {
+    cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
+    notify.events.forcePush(event);
+  }
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::BasicEngine(Sink s) : sink(s), books(), queuePositionEvents(false), inputSeq(0), inputTime(0), tickMode(EveryOrder), tickInterval(0), ordersSinceFlush(0), dirtyCount(0), dirty{} {}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::stop() 
+{
+  q.stop();
+  threadable::stop();
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::run() 
+{
+  // a synchronous tap waits once for a batch of the queued orders
+  const size_t BATCH = 64;
+  InputOrder batch[BATCH];
+  bool synchronous = any_of(inputTaps.begin(), inputTaps.end(), [](const InputTap& tap){ return nullptr != tap.acked; });
+
+  // drains the ingress queue before leaving
+  while (true)
+  {
+    // blocking call (depends on the ingress policy)
+    bool last = isShutdown.load(memory_order_acquire);
+    if (true == q.pop(batch[0])) 
+    {
+      size_t n = 1;
+      while (true == synchronous && n < BATCH && false == q.empty() && true == q.pop(batch[n])) n++;
+
+      inputTime = tapInputs(batch, n);
+      for (size_t i = 0; i < n; i++)
+      {
+        const InputOrder& newOrder = batch[i];
+        placeOrder(newOrder.instrument, newOrder.side, newOrder.trader, newOrder.qty, newOrder.type, newOrder.displayQty);
+      }
+      inputTime = 0;
+
+      // end of the batch, before the pop blocks (no lock taken)
+      if (0 != dirtyCount && true == q.empty()) flushTicks();
+    }
+    else if (true == last)
+    {
+      flushTicks();
+      break;
+    }
+    else
+    {
+      this_thread::yield();
+    }
+  }
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+uint64_t BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::tapInputs(const InputOrder* inputs, size_t n)
+{
+  // the clock is read only when somebody records it
+  uint64_t first = inputSeq + 1;
+  inputSeq += n;
+  if (true == inputTaps.empty()) return 0;
+
+  uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+  // the steady clock is read only when the engine has to wait
+  auto since = chrono::steady_clock::time_point();
+  auto wait = [&since](){
+    if (chrono::steady_clock::time_point() == since) since = chrono::steady_clock::now();
+    this_thread::yield();
+  };
+
+  for (auto& tap : inputTaps)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      SequencedInput input{first + i, now, inputs[i]};
+      bool pushed = tap.ring->push(input);
+
+      // a synchronous tap is not skipped while its reader is there
+      while (false == pushed && nullptr != tap.acked && true == tap.live->load(memory_order_acquire))
+      {
+        wait();
+        pushed = tap.ring->push(input);
+      }
+      if (false == pushed) tap.dropped->fetch_add(1, memory_order_relaxed);
+    }
+  }
+
+  for (auto& tap : inputTaps)
+  {
+    while (nullptr != tap.acked && tap.acked->load(memory_order_acquire) < inputSeq && true == tap.live->load(memory_order_acquire))
+    {
+      wait();
+    }
+  }
+
+  if (chrono::steady_clock::time_point() == since) return now;
+  uint64_t waited = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - since).count();
+  for (auto& tap : inputTaps)
+  {
+    if (nullptr == tap.held) continue;
+    tap.held->fetch_add(1, memory_order_relaxed);
+    tap.heldNs->fetch_add(waited, memory_order_relaxed);
+  }
+  return now;
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+inline void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::publish(const Event& event) 
+{
+  if (Exec == event.type || Cancelled == event.type) risk.onExec(event.instrument, event.trader, event.qty);
+  instrumentation.onEvent(event);
+  sink(event);
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+uint64_t BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::placeOrder(char instrument, Side side, uint16_t trader, uint32_t qty, OrderType type, uint32_t displayQty) 
+{
+  if (0 == qty || None == side) return NO_ORDER;
+  if (Iceberg == type && (0 == displayQty || displayQty >= qty)) type = Regular;
+
+  instrumentation.onOrder();
+
+  if (false == risk.admit(instrument, trader, qty, inputTime))
+  {
+    publish({Rejected, instrument, trader, qty, side});
+    return NO_ORDER;
+  }
+
+  BookT& book = books[instrument];
+  uint32_t remainQty = qty;
+  bool crossing = (false == book.orders.empty() && side != book.actualSide);
+
+  // fill or kill: all or nothing, the hidden quantity of icebergs counts too
+  if (FillOrKill == type && (false == crossing || book.outstandingQty + book.hiddenQty < qty))
+  {
+    publish({Cancelled, instrument, trader, qty, side});
+    return NO_ORDER;
+  }
+
+  // immediate or cancel never rests
+  if (ImmediateOrCancel == type && false == crossing)
+  {
+    publish({Cancelled, instrument, trader, qty, side});
+    return NO_ORDER;
+  }
+
+  while (true == crossing && false == book.orders.empty() && 0 != remainQty) {
+    // orders fully executed by the remaining quantity, found in one pass
+    uint64_t consumed = 0;
+    size_t executed = sweepOrders(book.orders.remainingData(), book.orders.size(), remainQty, consumed);
+    remainQty -= consumed;
+    book.outstandingQty -= consumed;
+    book.dequeuedQty += consumed;
+
+    for (size_t i = 0; i < executed; i++)
+    {
+      InternalOrder& top = book.orders.order(i);
+      book.openedOrdersQty -= top.qty;
+      risk.onFill(instrument, top.trader, Buy == book.actualSide, book.orders.remainingQty(i));
+      publish({Exec, instrument, top.trader, top.qty, book.actualSide, book.orders.id(i)});
+
+      // iceberg refresh, the new slice loses its time priority and is
+      // announced to its owner like a new order
+      if (0 != top.reserve)
+      {
+        InternalOrder iceberg = top;
+        uint32_t slice = min(iceberg.display, iceberg.reserve);
+        uint64_t sliceId = book.orders.id(book.orders.size()), qtyAhead = book.outstandingQty;
+        book.orders.push(iceberg.trader, slice, slice, iceberg.display, iceberg.reserve - slice);
+        book.hiddenQty -= slice;
+        book.outstandingQty += slice;
+        book.openedOrdersQty += slice;
+        publishResting(instrument, book, iceberg.trader, slice, book.actualSide, sliceId, qtyAhead);
+      }
+    }
+    book.orders.pop(executed);
+
+    // partial execution of the next one
+    if (0 != remainQty && false == book.orders.empty())
+    {
+      uint32_t& topRemainQty = book.orders.remainingQty(0);
+      if (topRemainQty > remainQty)
+      {
+        risk.onFill(instrument, book.orders.order(0).trader, Buy == book.actualSide, remainQty);
+        topRemainQty -= remainQty;
+        book.outstandingQty -= remainQty;
+        book.dequeuedQty += remainQty;
+        remainQty = 0;
+      }
+    }
+  }
+
+  // the aggressor, all its fills at once
+  if (qty != remainQty) risk.onFill(instrument, trader, Buy == side, qty - remainQty);
+
+  uint64_t id = NO_ORDER;
+  if (0 == remainQty)
+  {
+    publish({Exec, instrument, trader, qty, side});
+  }
+  else if (ImmediateOrCancel == type)
+  {
+    if (qty != remainQty)
+    {
+      publish({Exec, instrument, trader, qty - remainQty, side});
+    }
+    publish({Cancelled, instrument, trader, remainQty, side});
+  }
+  else
+  {
+    // the executed part is reported together with the first slice
+    uint32_t shown = (Iceberg == type) ? min(displayQty, remainQty) : remainQty;
+    uint32_t reserve = remainQty - shown;
+    uint64_t qtyAhead = book.orders.empty() ? 0 : book.outstandingQty;
+
+    book.actualSide = side;
+    id = book.orders.id(book.orders.size());
+    book.orders.push(trader, (qty - remainQty) + shown, shown, displayQty, reserve);
+    book.outstandingQty += shown;
+    book.openedOrdersQty += (qty - remainQty) + shown;
+    book.hiddenQty += reserve;
+
+    publishResting(instrument, book, trader, qty, side, id, qtyAhead);
+  }
+
+  marketView.publish(instrument, book);
+
+  // market data
+  if (EveryOrder == tickMode)
+  {
+    tick(instrument, book);
+  }
+  else if (Coalesced == tickMode)
+  {
+    unsigned char i = static_cast<unsigned char>(instrument);
+    if (false == dirty[i])
+    {
+      dirty[i] = true;
+      dirtyInstruments[dirtyCount++] = instrument;
+    }
+    if (0 != tickInterval && ++ordersSinceFlush >= tickInterval) flushTicks();
+  }
+  return id;
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+bool BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::queuePosition(char instrument, uint64_t order, uint64_t& qtyAhead) const
+{
+  auto it = books.find(instrument);
+  size_t i = 0;
+  if (books.end() == it || false == it->second.orders.find(order, i)) return false;
+  qtyAhead = it->second.orders.qtyAhead(i);
+  return true;
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+inline void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::publishResting(char instrument, const BookT& book, uint16_t trader, uint64_t qty, Side side, uint64_t order, uint64_t qtyAhead)
+{
+  // the executions move every order behind them up, the queue mark does not
+  // change, so there is nothing to send them later
+  publish({OrderPlaced, instrument, trader, qty, side, order});
+  if (true == queuePositionEvents) publish({QueuePosition, instrument, trader, book.dequeuedQty + qtyAhead, side, order});
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+inline void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::tick(char instrument, const BookT& book) 
+{
+  if (false == book.orders.empty())
+  {
+    publish({Tick, instrument, 0, book.outstandingQty, book.actualSide});
+  }
+  else
+  {
+    publish({Tick, instrument, 0, 0, None});
+  }
+}
+
+template <typename BookT, typename Sink, typename Instrumentation, typename Ingress, typename MarketView, typename Risk>
+void BasicEngine<BookT,Sink,Instrumentation,Ingress,MarketView,Risk>::flushTicks() 
+{
+  for (uint16_t i = 0; i < dirtyCount; i++)
+  {
+    char instrument = dirtyInstruments[i];
+    dirty[static_cast<unsigned char>(instrument)] = false;
+    tick(instrument, books[instrument]);
+  }
+  dirtyCount = 0;
+  ordersSinceFlush = 0;
+}
+
+template <typename BookT>
+void DepthSnapshots::publish(char instrument, const BookT& book)
+{
+  if (false == enabled) return;
+
+  BookSnapshot& snapshot = snapshots[static_cast<unsigned char>(instrument)];
+  BookDepth& depth = snapshot.depth;
+  uint32_t seq = snapshot.seq.load(memory_order_relaxed);
+
+  snapshot.seq.store(seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  depth.side = book.orders.empty() ? None : book.actualSide;
+  depth.outstandingQty = book.outstandingQty;
+  depth.dequeuedQty = book.dequeuedQty;
+  depth.firstId = book.orders.id(0);
+  depth.ordersCount = book.orders.size();
+  depth.size = 0;
+
+  uint64_t qtyAhead = 0;
+  for (size_t i = 0; i < book.orders.size() && depth.size < BookDepth::MAX_ORDERS; i++)
+  {
+    uint32_t remaining = book.orders.remainingQty(i);
+    depth.orders[depth.size++] = RestingOrder{book.orders.order(i).trader, remaining, qtyAhead};
+    qtyAhead += remaining;
+  }
+
+  snapshot.seq.store(seq + 2, memory_order_release);
+}
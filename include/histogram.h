@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// Log-linear histogram of nanoseconds, 1/64 relative precision: values
+// below 64 are exact, above that every power of two is split in 64 buckets.
+struct LatencyHistogram
+{
+  enum {SUB = 64, BUCKETS = 64 * SUB};
+
+  LatencyHistogram() : counts(BUCKETS, 0), total(0), max(0) {}
+
+  // bucket (shift + 1) * SUB + (v >> shift) - SUB, with v >> shift in [SUB, 2 * SUB)
+  static size_t index(uint64_t v)
+  {
+    if (v < SUB) return v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - 6;
+    return (shift + 1) * SUB + ((v >> shift) - SUB);
+  }
+
+  // the highest value of the bucket
+  static uint64_t value(size_t i)
+  {
+    if (i < SUB) return i;
+    int shift = i / SUB - 1;
+    return (uint64_t(SUB + i % SUB) << shift) + ((uint64_t(1) << shift) - 1);
+  }
+
+  void record(uint64_t v, uint64_t n = 1)
+  {
+    counts[index(v)] += n;
+    total += n;
+    if (v > max) max = v;
+  }
+
+  // HdrHistogram style coordinated omission correction
+  void record(uint64_t v, uint64_t expectedInterval, bool correct)
+  {
+    record(v);
+    if (false == correct || 0 == expectedInterval) return;
+    for (uint64_t missing = v; missing > expectedInterval; )
+    {
+      missing -= expectedInterval;
+      record(missing);
+    }
+  }
+
+  uint64_t percentile(double p) const
+  {
+    uint64_t rank = static_cast<uint64_t>(ceil(p / 100.0 * total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+      seen += counts[i];
+      if (seen >= rank && 0 != seen) return min(value(i), max);
+    }
+    return max;
+  }
+
+  vector<uint64_t> counts;
+  uint64_t total, max;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// Net position (bought - sold) and traded volume of one trader in one
+// instrument. There are no prices in the engine, so no P&L.
+struct Position
+{
+  int64_t position;
+  uint64_t volume;
+};
+
+// Positions of all the traders, one row of INSTRUMENTS per trader, updated
+// by the engine thread on every fill. The SLOTS rows are allocated up front
+// (only the pages of the rows in use are touched), a trader claims the next
+// slot with its first order and publishes it with a release store, a trader
+// without a slot has no position. The slot also holds the other per
+// instrument rows of the trader (see PreTradeRisk). Every trader row has its
+// own seqlock, so readers on other threads never block the engine and always
+// see the positions of a trader after a whole fill.
+struct PositionTable
+{
+  enum : uint32_t {TRADERS = 1<<16, INSTRUMENTS = 256, SLOTS = 8192};
+
+  PositionTable();
+
+  ~PositionTable();
+
+  PositionTable(const PositionTable&) = delete;
+  PositionTable& operator=(const PositionTable&) = delete;
+
+  // engine thread only
+  void fill(char instrument, uint16_t trader, bool buy, uint32_t qty);
+
+  // engine thread only, no seqlock needed
+  const Position& get(char instrument, uint16_t trader) const;
+
+  // any thread
+  Position read(char instrument, uint16_t trader) const;
+
+  // any thread, all the instruments of the trader at once (INSTRUMENTS entries)
+  void read(uint16_t trader, Position* out) const;
+
+  // engine thread only: the slot of the trader, claimed on the first call;
+  // SLOTS - all the slots are taken
+  uint32_t claim(uint16_t trader);
+
+  // engine thread only, nullptr - no slot
+  Position* row(uint16_t trader);
+
+  static const Position NONE[INSTRUMENTS];
+
+  vector<atomic<uint32_t>> seq;
+  vector<atomic<uint32_t>> slots; // slot + 1, 0 - none yet
+  Position* table;                // SLOTS rows
+  uint32_t used;
+};
+
+
+inline void PositionTable::fill(char instrument, uint16_t trader, bool buy, uint32_t qty)
+{
+  // the risk stage claimed the slot when it admitted the order
+  Position* r = row(trader);
+  if (nullptr == r) return;
+
+  atomic<uint32_t>& s = seq[trader];
+  uint32_t before = s.load(memory_order_relaxed);
+
+  s.store(before + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  Position& p = r[static_cast<unsigned char>(instrument)];
+  p.position += (true == buy) ? int64_t(qty) : -int64_t(qty);
+  p.volume += qty;
+
+  s.store(before + 2, memory_order_release);
+}
+
+inline uint32_t PositionTable::claim(uint16_t trader)
+{
+  uint32_t s = slots[trader].load(memory_order_relaxed);
+  if (0 != s) return s - 1;
+  if (SLOTS == used) return SLOTS;
+
+  slots[trader].store(++used, memory_order_release);
+  return used - 1;
+}
+
+inline Position* PositionTable::row(uint16_t trader)
+{
+  uint32_t s = claim(trader);
+  return (SLOTS == s) ? nullptr : table + size_t(s) * INSTRUMENTS;
+}
+
+inline const Position& PositionTable::get(char instrument, uint16_t trader) const
+{
+  uint32_t s = slots[trader].load(memory_order_relaxed);
+  return ((0 == s) ? NONE : table + size_t(s - 1) * INSTRUMENTS)[static_cast<unsigned char>(instrument)];
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <threadable.h>
+#include <connectors.h>
+#include <exchange.h>
+
+using namespace std;
+
+// One sequenced input order on the wire, seq is the input sequence of the
+// primary engine (the order it matched them in), the same as the seq column
+// of the inputs capture; time is the wall clock the primary took it at (the
+// rate limits of the pre-trade risk are decided on it).
+struct ReplicationRecord
+{
+  uint64_t seq;
+  uint64_t time;
+  uint32_t qty;
+  uint32_t displayQty;
+  uint16_t trader;
+  char instrument;
+  uint8_t side;
+  uint8_t type;
+  uint8_t reserved[3];
+  uint32_t crc; // crc32c of the bytes before
+};
+
+static_assert(sizeof(ReplicationRecord) == 40, "fixed size wire record");
+
+ReplicationRecord encodeRecord(const SequencedInput& input);
+
+bool decodeRecord(const ReplicationRecord& record, SequencedInput& input);
+
+// Primary side: forwards every input order the engine takes to the standby
+// over a unix socket, on its own thread. While the standby is not connected
+// (not started yet, restarting) or when the tap ring is full the records are
+// dropped, the standby catches up from the capture files. The standby acks
+// the last seq it applied. An asynchronous sender does not hold up the
+// primary (waitAcked waits for the standby); a synchronous one holds up the
+// matching of every batch of inputs, and so its events, until the standby
+// acked it, while the standby is connected. A standby that did not ack for
+// ackTimeout (catching up, stuck) no longer holds up the primary, the sender
+// is asynchronous until the standby acked everything sent, every such fall
+// back is counted in timeouts. The batches that held up the engine and the
+// time they did are counted in held and heldNs.
+struct ReplicationSender : public threadable
+{
+  ReplicationSender(const string& socketPath, bool synchronous = false);
+
+  ~ReplicationSender();
+
+  // taps the input orders of the engine, before the exchange starts
+  void attach(Exchange& ex);
+
+  virtual void run();
+
+  bool connect();
+
+  void disconnect();
+
+  // true once the standby applied everything up to seq, false after timeout
+  bool waitAcked(uint64_t seq, chrono::milliseconds timeout) const;
+
+  void readAcks();
+
+  SingleProducerSingleConsumerQueue<SequencedInput> inputs;
+  string socketPath;
+  bool synchronous;
+  int fd;
+  uint64_t seq; // last one taken from the ring
+  atomic<uint64_t> sent, dropped;
+  atomic<uint64_t> highWater; // last seq sent or dropped
+  atomic<uint64_t> acked;     // last seq the standby applied
+  atomic<uint64_t> held, heldNs;
+  atomic<uint64_t> timeouts;  // times the standby stopped holding up the primary
+  atomic<bool> connected;
+  atomic<bool> holding;       // a synchronous primary waits for the acks
+  chrono::milliseconds ackTimeout;
+  char ack[sizeof(uint64_t)];
+  size_t ackBytes;
+};
+
+// Standby side: a replica of the primary Exchange. The replica thread
+// applies the records of the primary in sequence to the books of `ex`
+// (exactly as the primary engine did, the sink drops the events). A missing
+// sequence is read from the inputs capture of the primary in `captureDir`,
+// the records after it wait in `pending` while the replica thread goes on
+// reading and acking the socket and looks at the capture again every ms.
+// When the gap is not filled within a second `failed` is set, the pending
+// records are counted in `missed` and the connection is closed, so a
+// synchronous primary does not wait for it; every later connection looks at
+// the capture once more. The exchange
+// itself is started by promote(), with the books already warm. The orders
+// are applied at the time the primary took them, so the rate limits of the
+// pre-trade risk decide the same.
+struct Standby : public threadable
+{
+  Standby(Exchange& ex, const string& socketPath, const string& captureDir);
+
+  ~Standby();
+
+  virtual void run();
+
+  // stops following the primary, applies the tail of the capture and starts
+  // the exchange; false (not started) when the books miss a received seq
+  bool promote();
+
+  // fills the gap before the pending records from the capture, gives up
+  // (failed) when it is older than a second, at once when already failed
+  void catchUp(chrono::steady_clock::time_point now);
+
+  // applies the pending records the capture filled the gaps before
+  bool applyPending();
+
+  // one pass over the capture, as far as it goes without a gap
+  void replayCapture(uint64_t seq);
+
+  void apply(const InputOrder& order, uint64_t time);
+
+  // tells the primary the last applied seq
+  void sendAck(int fd);
+
+  Exchange& ex;
+  string socketPath, captureDir;
+  int listenFd;
+  uint64_t nextSeq;
+  uint64_t lastSeq; // highest seq received
+  deque<SequencedInput> pending; // received after a gap
+  chrono::steady_clock::time_point gapSince;
+  atomic<uint64_t> applied, caughtUp, missed;
+  atomic<bool> connected, primaryGone, failed;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <positions.h>
+using namespace std;
+
+// Risk policies. The engine asks the risk stage to admit every order before
+// matching and reports every execution and every fill back to it, inline on
+// engine thread.
+struct NoRisk
+{
+  bool admit(char, uint16_t, uint32_t, uint64_t = 0) { return true; }
+  void onExec(char, uint16_t, uint64_t) {}
+  void onFill(char, uint16_t, bool, uint32_t) {}
+};
+
+struct TraderLimits
+{
+  uint32_t maxOrderQty;     // largest single order
+  uint64_t maxOpenQty;      // open (not fully executed) quantity per instrument
+  uint32_t maxOrdersPerSec; // 0 - no rate limit
+  uint64_t maxPosition;     // |position| + open quantity per instrument, 0 - no limit
+};
+
+// TraderLimits as the engine reads them. Every field is an atomic of its
+// own, a change made while the engine runs takes effect field by field.
+struct AtomicLimits
+{
+  atomic<uint32_t> maxOrderQty;
+  atomic<uint64_t> maxOpenQty;
+  atomic<uint32_t> maxOrdersPerSec;
+  atomic<uint64_t> maxPosition;
+};
+
+// Pre-trade risk with per-trader limits and kill switch. The state sits in
+// arrays indexed by the trader id, the per instrument rows (open quantity,
+// positions) in PositionTable::SLOTS rows allocated up front: a trader
+// claims a slot with its first order, nothing is allocated on the engine
+// thread and only the rows in use are touched. With all the slots taken the
+// orders of a new trader are rejected. Limits and kill switches can be
+// changed from any thread at any time.
+struct PreTradeRisk
+{
+  enum : uint32_t {TRADERS = 1<<16, INSTRUMENTS = 256, SLOTS = PositionTable::SLOTS};
+
+  PreTradeRisk();
+
+  ~PreTradeRisk();
+
+  PreTradeRisk(const PreTradeRisk&) = delete;
+  PreTradeRisk& operator=(const PreTradeRisk&) = delete;
+
+  void setLimits(uint16_t trader, const TraderLimits& traderLimits);
+
+  TraderLimits getLimits(uint16_t trader) const;
+
+  void kill(uint16_t trader);
+
+  void resume(uint16_t trader);
+
+  void killAll();
+
+  void resumeAll();
+
+  // engine thread only
+  uint64_t openQty(char instrument, uint16_t trader) const;
+
+  // the open quantities of the trader in its slot, nullptr - no slot left
+  uint64_t* openRow(uint16_t trader);
+
+  // time is the wall clock (ns) the engine took the order at, so a standby
+  // applying the same inputs takes the same rate limit decisions; 0 - now
+  bool admit(char instrument, uint16_t trader, uint32_t qty, uint64_t time = 0);
+
+  void onExec(char instrument, uint16_t trader, uint64_t qty);
+
+  // every fill, also the partial ones of the resting orders
+  void onFill(char instrument, uint16_t trader, bool buy, uint32_t qty);
+
+  struct RateWindow
+  {
+    uint32_t second;
+    uint32_t count;
+  };
+
+  vector<AtomicLimits> limits;
+  vector<RateWindow> rates;
+  vector<atomic<bool>> killed;
+  atomic<bool> killSwitch;
+  PositionTable positions; // owns the slots
+  uint64_t* open;          // SLOTS rows of INSTRUMENTS
+};
+
+
+inline uint64_t PreTradeRisk::openQty(char instrument, uint16_t trader) const
+{
+  uint32_t s = positions.slots[trader].load(memory_order_relaxed);
+  return (0 == s) ? 0 : open[size_t(s - 1) * INSTRUMENTS + static_cast<unsigned char>(instrument)];
+}
+
+inline uint64_t* PreTradeRisk::openRow(uint16_t trader)
+{
+  uint32_t s = positions.claim(trader);
+  return (SLOTS == s) ? nullptr : open + size_t(s) * INSTRUMENTS;
+}
+
+inline bool PreTradeRisk::admit(char instrument, uint16_t trader, uint32_t qty, uint64_t time)
+{
+  if (true == killSwitch.load(memory_order_relaxed)) return false;
+  if (true == killed[trader].load(memory_order_relaxed)) return false;
+
+  const AtomicLimits& limit = limits[trader];
+  if (qty > limit.maxOrderQty.load(memory_order_relaxed)) return false;
+
+  uint64_t* row = openRow(trader);
+  if (nullptr == row) return false;
+
+  // the limit may have been lowered below the open quantity
+  uint64_t& openQty = row[static_cast<unsigned char>(instrument)];
+  uint64_t maxOpenQty = limit.maxOpenQty.load(memory_order_relaxed);
+  if (openQty > maxOpenQty || qty > maxOpenQty - openQty) return false;
+
+  // worst case: all the open quantity gets filled on the same side
+  uint64_t maxPosition = limit.maxPosition.load(memory_order_relaxed);
+  if (0 != maxPosition)
+  {
+    int64_t position = positions.get(instrument, trader).position;
+    uint64_t exposure = uint64_t((position < 0) ? -position : position) + openQty + qty;
+    if (exposure > maxPosition) return false;
+  }
+
+  uint32_t maxOrdersPerSec = limit.maxOrdersPerSec.load(memory_order_relaxed);
+  if (0 != maxOrdersPerSec)
+  {
+    RateWindow& rate = rates[trader];
+    if (0 == time) time = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    uint32_t second = time / 1000000000;
+    if (second != rate.second)
+    {
+      rate.second = second;
+      rate.count = 0;
+    }
+    if (rate.count >= maxOrdersPerSec) return false;
+    rate.count++;
+  }
+
+  openQty += qty;
+  return true;
+}
+
+inline void PreTradeRisk::onExec(char instrument, uint16_t trader, uint64_t qty)
+{
+  // admitted, so the trader has its slot
+  uint64_t* row = openRow(trader);
+  if (nullptr != row) row[static_cast<unsigned char>(instrument)] -= qty;
+}
+
+inline void PreTradeRisk::onFill(char instrument, uint16_t trader, bool buy, uint32_t qty)
+{
+  positions.fill(instrument, trader, buy, qty);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// Column filter kernels for the capture reader (see capture.h). Clear the
+// bit of every row of `column` whose value is not `value`, one bit per row in
+// `mask`, 64 rows per word. Bits of the rows that match are left as they are,
+// so several filters can be applied to one mask.
+using FilterU8Kernel = void (*)(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask);
+using FilterU16Kernel = void (*)(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask);
+
+void filterU8Scalar(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask);
+
+void filterU8Sse42(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask);
+
+void filterU8Avx2(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask);
+
+void filterU16Scalar(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask);
+
+void filterU16Sse42(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask);
+
+void filterU16Avx2(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask);
+
+// selected at startup, see cpu.h
+extern FilterU8Kernel filterU8;
+extern FilterU16Kernel filterU16;
@@ -0,0 +1,74 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <threadable.h>
+#include <tradingtool.h>
+using namespace std;
+
+// Runs many TradingTools as stackless tasks on a small pool of threads. A
+// task is one TradingTool::poll: every worker takes the tool at the front of
+// its deque, polls it for a batch of events and puts it back at the end.
+// Without stealing a tool stays with the worker it was added to and the
+// deques take no lock; with stealing an idle worker takes a tool from the
+// back of another worker's deque, and every take and give, the owner's too,
+// locks the deque's mutex (uncontended unless a thief is at it), it is not a
+// lock-free work-stealing deque. Either way a tool is in at most one deque
+// or worker at a time, so its init/algo callbacks are never called
+// concurrently and keep their order. A worker yields when all of its tools
+// were empty. Attached to the Exchange the tools are connected to, a worker
+// that found its tools empty for PARK_ROUNDS rounds parks on the doorbell of
+// the Notifier, rung after delivering events, so a quiet market does not
+// keep the cores busy; not attached, the workers only poll. The doorbell
+// belongs to the Exchange, so a scheduler can go away before the exchange it
+// was attached to.
+struct TraderScheduler
+{
+  struct Worker : public threadable
+  {
+    Worker(TraderScheduler& owner, size_t idx) : scheduler(owner), index(idx) {}
+
+    virtual void run();
+
+    // sleeps until the Notifier delivers events, unless one more round
+    // finds some
+    void park(size_t tools);
+
+    TraderScheduler& scheduler;
+    size_t index;
+    mutex m; // every deque op when stealing
+    deque<TradingTool*> tasks;
+  };
+
+  TraderScheduler(size_t workersCount, bool stealing = false);
+
+  ~TraderScheduler();
+
+  // tools can be added only before start
+  void add(TradingTool* tool);
+
+  // lets the workers park, before the exchange and the scheduler start
+  // (throws logic_error after)
+  void attach(Exchange& ex);
+
+  void start();
+
+  void stop();
+
+  bool started() const;
+
+  bool take(size_t worker, TradingTool*& tool);
+
+  // back to the end of the worker's deque, returns the tools in it
+  size_t give(size_t worker, TradingTool* tool);
+
+  static const size_t BUDGET = 32;
+  static const size_t PARK_ROUNDS = 64;
+
+  vector<unique_ptr<Worker>> workers;
+  size_t next;
+  bool stealing;
+  Doorbell* doorbell; // of the exchange attached to, nullptr - only polls
+};
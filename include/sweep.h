@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// Sweep kernel: how many leading resting orders of `qty` are fully executed
+// by an aggressive order of `available` quantity. Their total quantity is
+// returned in `consumed`. One pass of a prefix sum, vectorised when the cpu
+// supports it.
+using SweepKernel = size_t (*)(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed);
+
+size_t sweepScalar(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed);
+
+size_t sweepSse42(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed);
+
+size_t sweepAvx2(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed);
+
+size_t sweepAvx512(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed);
+
+// selected at startup, see cpu.h
+extern SweepKernel sweepOrders;
@@ -1,5 +1,6 @@
 #pragma once
 #include <thread>
+#include <atomic>
 using namespace std;
 
 struct threadable
@@ -15,6 +16,7 @@ struct threadable
   virtual void run() = 0;
 
   thread* the;
-  bool isShutdown;
+  // set by stop(), loops of run() poll it with acquire loads (no fences)
+  atomic<bool> isShutdown;
 };
 
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <tradingtool.h>
+#include <scheduler.h>
+using namespace std;
+
+// Market maker keeps `orders` resting orders of `qty` on its side, every
+// executed order is replaced. The book has no prices, so opposite orders
+// always cross: all the makers of one instrument should quote the same side.
+struct MarketMakerParams
+{
+  char instrument;
+  Side side;
+  uint32_t qty;
+  uint32_t orders;
+};
+
+// Taker sends `orders` orders of `qty` on its side (None - alternating), the
+// next one after the previous is executed in full or cancelled. A taker the
+// exchange no longer takes orders from (closed) is done.
+struct TakerParams
+{
+  char instrument;
+  Side side;
+  uint32_t qty;
+  uint32_t orders;
+  OrderType type;
+  uint32_t displayQty; // of an Iceberg
+};
+
+// Owns a population of TradingTool agents connected to one Exchange and runs
+// them as the tasks of a stealing TraderScheduler (see scheduler.h, the
+// deques are locked): an idle worker steals agents from the others, an
+// agent's callbacks still keep their order and never run concurrently.
+// Constructed before the exchange starts (the scheduler is attached to it),
+// the exchange outlives the pool.
+struct TraderPool
+{
+  TraderPool(Exchange& ex, size_t workersCount);
+
+  ~TraderPool();
+
+  // agents can be added only before start
+  TradingTool* addAgent(uint16_t id, function<void(TradingTool*)> init, function<void(TradingTool*,Event)> algo);
+
+  void addMarketMakers(uint16_t firstId, uint16_t count, const MarketMakerParams& params);
+
+  void addTakers(uint16_t firstId, uint16_t count, const TakerParams& params);
+
+  // true when every taker has got all its orders executed or cancelled
+  bool takersDone() const;
+
+  void start();
+
+  void stop();
+
+  Exchange& exchange;
+  vector<unique_ptr<TradingTool>> agents;
+  TraderScheduler scheduler;
+  atomic<uint32_t> takers, finishedTakers;
+  atomic<uint64_t> refused; // orders the closed exchange did not take
+};
@@ -16,9 +16,14 @@ struct TradingTool : public threadable
 
   void virtual run(); 
 
+  // One step of the trader: init on the first call, then at most budget
+  // events. Returns false when there was nothing to do. Lets many traders
+  // share a thread (see TraderScheduler) instead of running their own.
+  bool poll(size_t budget);
+
   gateway* q;
   uint16_t id;
+  bool initialized;
   function<void(TradingTool*,Event)> algo;
   function<void(TradingTool*)> init;
 };
-
@@ -0,0 +1,361 @@
+#include <capture.h>
+#include <scan.h>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <system_error>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+static const char MAGIC[8] = {'E', 'X', 'C', 'A', 'P', 'T', '0', '2'};
+
+size_t columnWidth(CaptureColumn column)
+{
+  switch (column)
+  {
+    case SeqColumn: case TimeColumn: case QtyColumn: case OrderIdColumn: return 8;
+    case DisplayQtyColumn: return 4;
+    case TraderColumn: return 2;
+    default: return 1;
+  }
+}
+
+static string segmentPath(const string& dir, const string& name, uint32_t segment)
+{
+  char number[16];
+  snprintf(number, sizeof(number), "-%06u.cap", segment);
+  return dir + "/" + name + number;
+}
+
+// the columns after the header page, each one aligned to a cache line
+static size_t segmentLayout(uint64_t capacity, uint64_t offsets[COLUMNS])
+{
+  size_t bytes = SegmentHeader::SIZE;
+  for (int c = 0; c < COLUMNS; c++)
+  {
+    offsets[c] = bytes;
+    bytes += (capacity * columnWidth(CaptureColumn(c)) + 63) & ~size_t(63);
+  }
+  return bytes;
+}
+
+SegmentWriter::SegmentWriter(const string& d, const string& n, CaptureKind k, uint64_t c) :
+  dir(d), name(n), kind(k), capacity(c), segment(0), rows(0), bytes(0), base(nullptr), column{}
+{
+  uint64_t offsets[COLUMNS];
+  bytes = segmentLayout(capacity, offsets);
+}
+
+SegmentWriter::~SegmentWriter()
+{
+  close();
+}
+
+uint8_t* SegmentWriter::allocate(uint32_t number) const
+{
+  string path = segmentPath(dir, name, number);
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw system_error(errno, generic_category(), path);
+
+  // posix_fallocate returns the error, it does not set errno
+  int error = (0 != ftruncate(fd, bytes)) ? errno : posix_fallocate(fd, 0, bytes);
+  void* p = MAP_FAILED;
+  if (0 == error)
+  {
+    p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (MAP_FAILED == p) error = errno;
+  }
+  ::close(fd);
+
+  // no half made segment left behind for the readers
+  if (0 != error)
+  {
+    unlink(path.c_str());
+    throw system_error(error, generic_category(), path);
+  }
+
+  SegmentHeader* header = static_cast<SegmentHeader*>(p);
+  memcpy(header->magic, MAGIC, sizeof(MAGIC));
+  header->kind = kind;
+  header->columns = COLUMNS;
+  header->capacity = capacity;
+  header->rows = 0;
+  header->firstSeq = 0;
+  segmentLayout(capacity, header->offsets);
+  return static_cast<uint8_t*>(p);
+}
+
+void SegmentWriter::open()
+{
+  segment++;
+  rows = 0;
+
+  // normally allocated while the previous one was filling up
+  base = (true == next.valid()) ? next.get() : allocate(segment);
+
+  const SegmentHeader* header = reinterpret_cast<const SegmentHeader*>(base);
+  for (int c = 0; c < COLUMNS; c++) column[c] = base + header->offsets[c];
+}
+
+void SegmentWriter::commit()
+{
+  if (nullptr == base) return;
+  __atomic_store_n(&reinterpret_cast<SegmentHeader*>(base)->rows, rows, __ATOMIC_RELEASE);
+}
+
+void SegmentWriter::close()
+{
+  if (nullptr != base)
+  {
+    commit();
+    munmap(base, bytes);
+    base = nullptr;
+  }
+
+  // a next segment that got no rows is not left behind
+  if (true == next.valid())
+  {
+    try
+    {
+      munmap(next.get(), bytes);
+      unlink(segmentPath(dir, name, segment + 1).c_str());
+    }
+    catch (const system_error&) {}
+  }
+}
+
+void SegmentWriter::append(uint64_t seq, uint64_t time, uint8_t type, char instrument, uint16_t trader, uint64_t qty, uint8_t side, uint32_t displayQty, uint64_t orderId)
+{
+  if (nullptr == base || capacity == rows)
+  {
+    if (nullptr != base)
+    {
+      commit();
+      munmap(base, bytes);
+      base = nullptr;
+    }
+    open();
+    reinterpret_cast<SegmentHeader*>(base)->firstSeq = seq;
+  }
+
+  reinterpret_cast<uint64_t*>(column[SeqColumn])[rows] = seq;
+  reinterpret_cast<uint64_t*>(column[TimeColumn])[rows] = time;
+  column[TypeColumn][rows] = type;
+  column[InstrumentColumn][rows] = static_cast<uint8_t>(instrument);
+  reinterpret_cast<uint16_t*>(column[TraderColumn])[rows] = trader;
+  reinterpret_cast<uint64_t*>(column[QtyColumn])[rows] = qty;
+  column[SideColumn][rows] = side;
+  reinterpret_cast<uint32_t*>(column[DisplayQtyColumn])[rows] = displayQty;
+  reinterpret_cast<uint64_t*>(column[OrderIdColumn])[rows] = orderId;
+  rows++;
+
+  if (rows > capacity / 2 && false == next.valid())
+  {
+    next = async(launch::async, &SegmentWriter::allocate, this, segment + 1);
+  }
+}
+
+Capture::Capture(const string& dir, uint64_t segmentRows) :
+  eventsWriter(dir, "events", EventsCapture, segmentRows),
+  inputsWriter(dir, "inputs", InputsCapture, segmentRows),
+  eventsSeq(0), inputsSeq(0), failed(false), dropped(0) {}
+
+Capture::~Capture()
+{
+  stop();
+}
+
+void Capture::attach(Exchange& ex)
+{
+  ex.notif.capture = &events;
+  ex.notif.captureDropped = &dropped;
+  ex.engine.inputTaps.push_back(InputTap{&inputs, &dropped});
+}
+
+void Capture::run()
+{
+  const size_t BATCH = 256;
+  SequencedEvent eventsBatch[BATCH];
+  SequencedInput inputsBatch[BATCH];
+
+  // drains both rings before leaving
+  while (true)
+  {
+    bool last = isShutdown.load(memory_order_acquire);
+    size_t n = events.pop(eventsBatch, BATCH);
+    size_t m = inputs.pop(inputsBatch, BATCH);
+
+    if (0 == n && 0 == m)
+    {
+      if (true == last) break;
+      this_thread::yield();
+      continue;
+    }
+
+    // keeps draining, the records are counted here rather than at full rings
+    if (true == failed.load(memory_order_relaxed))
+    {
+      dropped.fetch_add(n + m, memory_order_relaxed);
+      continue;
+    }
+
+    // one timestamp per batch of events
+    uint64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::system_clock::now().time_since_epoch()).count();
+    size_t written = 0;
+    try
+    {
+      for (size_t i = 0; i < m; i++)
+      {
+        const InputOrder& o = inputsBatch[i].order;
+        inputsWriter.append(inputsBatch[i].seq, inputsBatch[i].time, o.type, o.instrument, o.trader, o.qty, o.side, o.displayQty, UINT64_MAX);
+        inputsSeq = inputsBatch[i].seq;
+        written++;
+      }
+      for (size_t i = 0; i < n; i++)
+      {
+        const Event& e = eventsBatch[i].event;
+        eventsWriter.append(eventsBatch[i].seq, now, e.type, e.instrument, e.trader, e.qty, e.side, 0, e.orderId);
+        eventsSeq = eventsBatch[i].seq;
+        written++;
+      }
+      inputsWriter.commit();
+      eventsWriter.commit();
+    }
+    catch (const system_error& e)
+    {
+      error = e.what();
+      dropped.fetch_add(n + m - written, memory_order_relaxed);
+      failed.store(true, memory_order_release);
+      fprintf(stderr, "capture: %s, not recording any more\n", e.what());
+      inputsWriter.close();
+      eventsWriter.close();
+    }
+  }
+
+  inputsWriter.close();
+  eventsWriter.close();
+}
+
+SegmentReader::SegmentReader() : header(nullptr), base(nullptr), bytes(0) {}
+
+SegmentReader::~SegmentReader()
+{
+  close();
+}
+
+bool SegmentReader::open(const string& path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (0 != fstat(fd, &st) || st.st_size < SegmentHeader::SIZE)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (MAP_FAILED == p) return false;
+
+  base = static_cast<const uint8_t*>(p);
+  bytes = st.st_size;
+  header = reinterpret_cast<const SegmentHeader*>(base);
+  bool valid = 0 == memcmp(header->magic, MAGIC, sizeof(MAGIC)) && COLUMNS == header->columns &&
+               header->capacity <= bytes && rows() <= header->capacity;
+
+  // a truncated or damaged file must not send the reads past the mapping
+  for (int c = 0; c < COLUMNS && true == valid; c++)
+  {
+    uint64_t offset = header->offsets[c], width = columnWidth(CaptureColumn(c));
+    valid = offset >= SegmentHeader::SIZE && offset <= bytes && 0 == offset % width && header->capacity * width <= bytes - offset;
+  }
+  if (false == valid)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void SegmentReader::close()
+{
+  if (nullptr == base) return;
+  munmap(const_cast<uint8_t*>(base), bytes);
+  base = nullptr;
+  header = nullptr;
+  bytes = 0;
+}
+
+size_t SegmentReader::select(const CaptureFilter& filter, vector<uint64_t>& out) const
+{
+  size_t n = rows();
+  vector<uint64_t> mask((n + 63) / 64, ~uint64_t(0));
+  if (0 != n % 64) mask.back() = (uint64_t(1) << (n % 64)) - 1;
+
+  if (-1 != filter.instrument) filterU8(data<uint8_t>(InstrumentColumn), n, static_cast<uint8_t>(filter.instrument), mask.data());
+  if (-1 != filter.type) filterU8(data<uint8_t>(TypeColumn), n, static_cast<uint8_t>(filter.type), mask.data());
+  if (-1 != filter.trader) filterU16(data<uint16_t>(TraderColumn), n, static_cast<uint16_t>(filter.trader), mask.data());
+
+  size_t before = out.size();
+  for (size_t w = 0; w < mask.size(); w++)
+  {
+    for (uint64_t bits = mask[w]; 0 != bits; bits &= bits - 1)
+    {
+      out.push_back(w * 64 + __builtin_ctzll(bits));
+    }
+  }
+  return out.size() - before;
+}
+
+Event SegmentReader::event(size_t row) const
+{
+  return Event{static_cast<EventType>(data<uint8_t>(TypeColumn)[row]),
+               static_cast<char>(data<uint8_t>(InstrumentColumn)[row]),
+               data<uint16_t>(TraderColumn)[row],
+               data<uint64_t>(QtyColumn)[row],
+               static_cast<Side>(data<uint8_t>(SideColumn)[row]),
+               data<uint64_t>(OrderIdColumn)[row]};
+}
+
+InputOrder SegmentReader::input(size_t row) const
+{
+  InputOrder o{static_cast<char>(data<uint8_t>(InstrumentColumn)[row]),
+               data<uint16_t>(TraderColumn)[row],
+               static_cast<uint32_t>(data<uint64_t>(QtyColumn)[row]),
+               static_cast<Side>(data<uint8_t>(SideColumn)[row])};
+  o.type = static_cast<OrderType>(data<uint8_t>(TypeColumn)[row]);
+  o.displayQty = data<uint32_t>(DisplayQtyColumn)[row];
+  return o;
+}
+
+vector<string> captureSegments(const string& dir, const string& name)
+{
+  vector<string> paths;
+  DIR* d = opendir(dir.c_str());
+  if (nullptr == d) return paths;
+
+  string prefix = name + "-";
+  while (dirent* entry = readdir(d))
+  {
+    string file = entry->d_name;
+    if (0 == file.compare(0, prefix.size(), prefix) && file.size() > 4 && 0 == file.compare(file.size() - 4, 4, ".cap"))
+    {
+      paths.push_back(dir + "/" + file);
+    }
+  }
+  closedir(d);
+
+  // fixed width numbers, sorted by name is sorted by segment
+  sort(paths.begin(), paths.end());
+  return paths;
+}
@@ -0,0 +1,56 @@
+#include <checksum.h>
+#include <immintrin.h>
+using namespace std;
+
+Crc32cKernel crc32c = crc32cGeneric;
+
+struct Crc32cTable
+{
+  Crc32cTable()
+  {
+    for (uint32_t i = 0; i < 256; i++)
+    {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++)
+      {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+
+  uint32_t entries[256];
+};
+
+uint32_t crc32cGeneric(uint32_t crc, const void* data, size_t len)
+{
+  static const Crc32cTable table;
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, const void* data, size_t len)
+{
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint64_t c = ~crc;
+
+  for (; len >= 8; len -= 8, p += 8)
+  {
+    uint64_t word;
+    __builtin_memcpy(&word, p, 8);
+    c = _mm_crc32_u64(c, word);
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  for (; len > 0; len--, p++)
+  {
+    c32 = _mm_crc32_u8(c32, *p);
+  }
+  return ~c32;
+}
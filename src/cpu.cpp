@@ -0,0 +1,75 @@
+#include <cpu.h>
+#include <sweep.h>
+#include <checksum.h>
+#include <scan.h>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+using namespace std;
+
+static Isa active = Generic;
+
+Isa cpuIsa()
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Avx512;
+  if (__builtin_cpu_supports("avx2")) return Avx2;
+  if (__builtin_cpu_supports("sse4.2")) return Sse42;
+  return Generic;
+}
+
+bool cpuSupports(Isa isa)
+{
+  return isa <= cpuIsa();
+}
+
+const char* isaName(Isa isa)
+{
+  switch (isa)
+  {
+    case Sse42: return "sse42";
+    case Avx2: return "avx2";
+    case Avx512: return "avx512";
+    default: return "generic";
+  }
+}
+
+Isa dispatchKernels(Isa isa)
+{
+  if (isa > cpuIsa()) isa = cpuIsa();
+
+  switch (isa)
+  {
+    case Avx512: sweepOrders = sweepAvx512; break;
+    case Avx2: sweepOrders = sweepAvx2; break;
+    case Sse42: sweepOrders = sweepSse42; break;
+    default: sweepOrders = sweepScalar; break;
+  }
+  crc32c = (isa >= Sse42) ? crc32cSse42 : crc32cGeneric;
+  // no avx512 variants: byte compares need avx512bw, not only avx512f
+  filterU8 = (isa >= Avx2) ? filterU8Avx2 : (isa >= Sse42) ? filterU8Sse42 : filterU8Scalar;
+  filterU16 = (isa >= Avx2) ? filterU16Avx2 : (isa >= Sse42) ? filterU16Sse42 : filterU16Scalar;
+
+  active = isa;
+  return isa;
+}
+
+Isa activeIsa()
+{
+  return active;
+}
+
+static Isa startupIsa()
+{
+  const char* env = getenv("EXENGINE_ISA");
+  if (nullptr != env)
+  {
+    for (Isa isa : {Generic, Sse42, Avx2, Avx512})
+    {
+      if (0 == strcmp(env, isaName(isa))) return dispatchKernels(isa);
+    }
+  }
+  return dispatchKernels(cpuIsa());
+}
+
+static const Isa selected = startupIsa();
@@ -3,24 +3,36 @@
 #include <iostream>
 using namespace std;
 
-Notifier::Notifier() {}
+Notifier::Notifier() : capture(nullptr), captureDropped(nullptr), captureSeq(0), ringing(false) {}
 
 void Notifier::run() 
 {
-  while (false == isShutdown) {
-    Event event;
-    if (true == events.pop(event))
+  const size_t BATCH = 64;
+  Event batch[BATCH];
+
+  // drains the events ring before leaving
+  while (true) {
+    // read before the pop, so the pop sees every event pushed before stop()
+    bool last = isShutdown.load(memory_order_acquire);
+    size_t n = events.pop(batch, BATCH);
+    size_t delivered = 0;
+    for (size_t i = 0; i < n; i++)
     {
+      const Event& event = batch[i];
       switch(event.type)
       {
         case EventType::Exec:
         case EventType::OrderPlaced:
+        case EventType::QueuePosition:
+        case EventType::Rejected:
+        case EventType::Cancelled:
         {
           if (false == clients[event.trader]->push(event))
           {
             cout << "NOTIFIER WARNING: events ring is full!. Increse the clients event buffer size!.\n";
             clients[event.trader]->forcePush(event);
           }
+          delivered++;
           break;
         }
         case EventType::Tick:
@@ -30,10 +42,21 @@ void Notifier::run()
         }
       }
 
-      // logging events to file right here...
     }
-    else
+
+    // wakes up the parked workers of the schedulers, once per batch
+    if (0 != delivered && true == ringing) doorbell.ring();
+
+    // logging events to file off this thread (see capture.h), never waits
+    // for the capture thread, a full ring loses the events (a gap in seq)
+    for (size_t i = 0; nullptr != capture && i < n; i++)
+    {
+      if (false == capture->push(SequencedEvent{++captureSeq, batch[i]})) captureDropped->fetch_add(1, memory_order_relaxed);
+    }
+
+    if (0 == n)
     {
+      if (true == last) break;
       this_thread::yield(); //not needed if busy loop
     }
   }
@@ -44,116 +67,57 @@ void Notifier::registerClient(uint16_t id, SingleProducerSingleConsumerQueue<Eve
   clients[id] = events;
 }
 
-void Engine::stop() 
-{
-  q.stop();
-  threadable::stop();
-}
-
-Engine::Engine(Notifier& notifier) : books(), notify(notifier) {}
+BookSnapshot::BookSnapshot() : seq(0), depth{None, 0, 0, 0, 0, 0, {}} {}
 
-void Engine::run() 
+bool BookSnapshot::read(BookDepth& out) const
 {
-  while (false == isShutdown)
+  uint32_t before = 0;
+  do
   {
-    // blocking call
-    InputOrder newOrder;
-    if (true == q.pop(newOrder)) 
+    while ((before = seq.load(memory_order_acquire)) & 1)
     {
-      placeOrder(newOrder.instrument, newOrder.side, newOrder.trader, newOrder.qty);
+      this_thread::yield();
     }
+    out = depth;
+    atomic_thread_fence(memory_order_acquire);
   }
+  while (before != seq.load(memory_order_relaxed));
+
+  return 0 != before;
 }
 
-void Engine::placeOrder(char instrument, Side side, uint16_t trader, uint16_t qty) 
+bool DepthSnapshots::read(char instrument, BookDepth& depth) const
 {
-  if (0 == qty || None == side) return;
-
-  Book& book = books[instrument];
-  uint16_t remainQty = qty;
-
-
-  if (true == book.orders.empty() || side == book.actualSide) {
-    book.actualSide = side;
-    book.orders.emplace_back(trader, qty);
-    book.outstandingQty += qty;
-    book.openedOrdersQty += qty;
-
-    if (false == notify.events.push({OrderPlaced, instrument, trader, qty, side}))
-    {
-      cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-      notify.events.forcePush({OrderPlaced, instrument, trader, qty, side});
-    }
-  }
-  else
-  {
-    while (false == book.orders.empty() && 0 != remainQty) {
-      InternalOrder& top = book.orders.front();
-      uint32_t topRemainQty = (top.qty + book.outstandingQty) - book.openedOrdersQty;
-      if (topRemainQty > remainQty)
-      {
-        book.outstandingQty -= remainQty;
-        remainQty = 0;
-      }
-      else {
-        remainQty -= topRemainQty;
-        book.orders.pop_front();
-        book.outstandingQty -= topRemainQty;
-        book.openedOrdersQty -= top.qty;
+  return snapshots[static_cast<unsigned char>(instrument)].read(depth);
+}
 
-        if (false == notify.events.push({Exec, instrument, top.trader, top.qty, book.actualSide}))
-        {
-          cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-          notify.events.forcePush({Exec, instrument, top.trader, top.qty, book.actualSide});
-        }
-      }
-    }
+void Exchange::registerClient(uint16_t id, TradingTool* client) 
+{
+  notif.registerClient(id, &client->events);
+}
 
-    if (0 == remainQty)
-    {
-      if (false == notify.events.push({Exec, instrument, trader, qty, side}))
-      {
-        cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-        notify.events.forcePush({Exec, instrument, trader, qty, side});
-      }
-    }
-    else
-    {
-      book.actualSide = side;
-      book.orders.emplace_back(trader, qty);
-      book.outstandingQty += remainQty;
-      book.openedOrdersQty += qty;
-      if (false == notify.events.push({OrderPlaced, instrument, trader, qty, side}))
-      {
-        cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-        notify.events.forcePush({OrderPlaced, instrument, trader, qty, side});
-      }
-    }
-  }
+bool Exchange::depth(char instrument, BookDepth& out) const
+{
+  return engine.marketView.read(instrument, out);
+}
 
-  // market data
-  if (false == book.orders.empty())
-  {
-    if (false == notify.events.push({Tick, instrument, 0, book.outstandingQty, book.actualSide}))
-    {
-      cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-      notify.events.forcePush({Tick, instrument, 0, book.outstandingQty, book.actualSide});
-    }
-  }
-  else
-  {
-    if (false == notify.events.push({Tick, instrument, 0, 0, None}))
-    {
-      cout << "ENGINE WARNING: events ring is full!. Increse the event buffer size!.\n";
-      notify.events.forcePush({Tick, instrument, 0, 0, None});
-    }
-  }
+Position Exchange::position(char instrument, uint16_t trader) const
+{
+  return engine.risk.positions.read(instrument, trader);
 }
 
+bool Exchange::queuePosition(char instrument, uint64_t order, uint64_t mark, uint64_t& qtyAhead) const
+{
+  // at the front (qtyAhead 0) or executed already
+  BookDepth d;
+  if (false == depth(instrument, d) || order < d.firstId || order - d.firstId >= d.ordersCount) return false;
+  qtyAhead = (mark > d.dequeuedQty) ? mark - d.dequeuedQty : 0;
+  return true;
+}
 
-void Exchange::registerClient(uint16_t id, TradingTool* client) 
+Exchange::~Exchange() 
 {
-  notif.registerClient(id, &client->events);
+  stop();
 }
 
 void Exchange::start() 
@@ -162,10 +126,33 @@ void Exchange::start()
   notif.start();
 }
 
+void Exchange::close() 
+{
+  engine.q.close();
+}
+
 void Exchange::stop() 
 {
-  notif.stop();
+  close();
   engine.stop();
+  notif.stop();
+}
+
+void Exchange::stopDiscarding(SingleProducerSingleConsumerQueue<Event>& unread)
+{
+  atomic<bool> stopped(false);
+  thread stopping([&](){
+    stop();
+    stopped.store(true, memory_order_release);
+  });
+
+  Event events[64];
+  while (false == stopped.load(memory_order_acquire))
+  {
+    if (0 == unread.pop(events, 64)) this_thread::yield();
+  }
+  stopping.join();
+  while (0 != unread.pop(events, 64));
 }
 
 
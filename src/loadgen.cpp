@@ -0,0 +1,284 @@
+// Synthetic order flow generator and latency tool.
+//
+// Drives an in-process Exchange with configurable order flow and reports the
+// sustained throughput and the order latency percentiles. The latency of an
+// order is the time from when the order was supposed to be sent until its
+// first event (OrderPlaced, Exec, Cancelled or Rejected) reaches the client.
+// In open loop mode orders are scheduled at a fixed rate and the latency is
+// measured from the scheduled time, so stalls of the generator itself are not
+// hidden (coordinated omission). In closed loop mode at most `inflight`
+// orders wait for their first event; --rate caps the send rate and the
+// samples are corrected for its interval the same way as HdrHistogram does.
+//
+// Every order in flight or resting in a book uses its own trader id, all the
+// ids are registered to one events ring. An id is reused only once its order
+// is done, so the first event of an id is always the response to its order.
+#include <exchange.h>
+#include <connectors.h>
+#include <capture.h>
+#include <histogram.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cinttypes>
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+using namespace std;
+
+struct Options
+{
+  uint64_t orders = 1000000;
+  double rate = 0;            // orders per second, 0 - as fast as possible
+  bool closedLoop = false;
+  uint32_t inflight = 64;     // closed loop only
+  uint32_t instruments = 1;
+  double buyRatio = 0.5;
+  double iocRatio = 0.0;
+  uint32_t qtyMin = 1;
+  uint32_t qtyMax = 100;
+  uint64_t seed = 1;
+  string capture;             // directory of the capture segments, empty - off
+};
+
+static void usage()
+{
+  cout << "usage: loadgen [options]\n"
+       << "  --orders=N        number of orders to send (1000000)\n"
+       << "  --rate=R          orders per second, 0 - as fast as possible (0);\n"
+       << "                    closed loop: at most R, samples corrected for 1/R\n"
+       << "  --mode=open|closed  open loop (scheduled) or closed loop (open)\n"
+       << "  --inflight=N      closed loop: orders waiting for the first event (64)\n"
+       << "  --instruments=N   number of instruments, 'A', 'B', ... (1)\n"
+       << "  --buy=F           ratio of buy orders (0.5)\n"
+       << "  --ioc=F           ratio of immediate-or-cancel orders (0)\n"
+       << "  --qty=MIN:MAX     uniform order quantity (1:100)\n"
+       << "  --seed=N          random seed (1)\n"
+       << "  --capture=DIR     record inputs and events to DIR (off)\n";
+}
+
+static bool parse(int argc, char** argv, Options& o)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    string arg = argv[i];
+    size_t eq = arg.find('=');
+    string key = arg.substr(0, eq);
+    string val = (string::npos == eq) ? "" : arg.substr(eq + 1);
+
+    if ("--orders" == key) o.orders = stoull(val);
+    else if ("--rate" == key) o.rate = stod(val);
+    else if ("--mode" == key && ("open" == val || "closed" == val)) o.closedLoop = ("closed" == val);
+    else if ("--inflight" == key) o.inflight = stoul(val);
+    else if ("--instruments" == key) o.instruments = stoul(val);
+    else if ("--buy" == key) o.buyRatio = stod(val);
+    else if ("--ioc" == key) o.iocRatio = stod(val);
+    else if ("--qty" == key && string::npos != val.find(':'))
+    {
+      o.qtyMin = stoul(val.substr(0, val.find(':')));
+      o.qtyMax = stoul(val.substr(val.find(':') + 1));
+    }
+    else if ("--seed" == key) o.seed = stoull(val);
+    else if ("--capture" == key && false == val.empty()) o.capture = val;
+    else return false;
+  }
+  return 0 != o.orders && 0 != o.instruments && o.instruments <= 26 && 0 != o.inflight && o.qtyMin <= o.qtyMax && 0 != o.qtyMin;
+}
+
+int main(int argc, char** argv)
+{
+  Options o;
+  try
+  {
+    if (false == parse(argc, argv, o))
+    {
+      usage();
+      return 1;
+    }
+  }
+  catch (const exception&)
+  {
+    usage();
+    return 1;
+  }
+
+  using clock = chrono::steady_clock;
+  enum State : uint8_t {Free, Resting, AwaitCancel};
+  // every id gets one of the slots of the risk stage
+  const uint16_t IDS = PreTradeRisk::SLOTS - 192;
+
+  Exchange ex;
+  auto* events = new SingleProducerSingleConsumerQueue<Event>();
+  auto* freed = new SingleProducerSingleConsumerQueue<uint16_t, (1<<16)>();
+  vector<clock::time_point> intended(IDS + 1);
+  vector<uint32_t> orderQty(IDS + 1, 0);
+  vector<State> state(IDS + 1, Free);
+  atomic<uint64_t> acked(0);
+
+  // all the ids share the one events ring
+  for (uint16_t id = 1; id <= IDS; id++) ex.notif.registerClient(id, events);
+
+  unique_ptr<Capture> capture;
+  if (false == o.capture.empty())
+  {
+    capture.reset(new Capture(o.capture));
+    capture->attach(ex);
+    capture->start();
+  }
+  ex.start();
+
+  LatencyHistogram histogram;
+  const uint64_t interval = (0 != o.rate) ? static_cast<uint64_t>(1e9 / o.rate) : 0;
+  const bool correct = o.closedLoop && 0 != interval;
+  atomic<bool> giveUp(false);
+  uint64_t sent = 0, stalls = 0, refused = 0;
+
+  auto start = clock::now();
+
+  thread generator([&](){
+    mt19937_64 rng(o.seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    uniform_int_distribution<uint32_t> qty(o.qtyMin, o.qtyMax);
+    uniform_int_distribution<uint32_t> instrument(0, o.instruments - 1);
+    vector<uint16_t> ids;
+    for (uint16_t id = IDS; id >= 1; id--) ids.push_back(id);
+
+    for (uint64_t i = 0; i < o.orders; i++)
+    {
+      clock::time_point when = clock::now();
+      if (false == o.closedLoop && 0 != interval)
+      {
+        when = start + chrono::nanoseconds(i * interval);
+        while (clock::now() < when && false == giveUp) this_thread::yield();
+      }
+      if (true == o.closedLoop)
+      {
+        while (i - acked.load(memory_order_acquire) >= o.inflight && false == giveUp) this_thread::yield();
+
+        // never faster than --rate, the correction assumes that interval
+        if (0 != interval)
+        {
+          auto due = start + chrono::nanoseconds(i * interval);
+          while (clock::now() < due && false == giveUp) this_thread::yield();
+        }
+        when = clock::now();
+      }
+
+      // every id held by a resting order: a skewed side mix fills the books
+      uint16_t id = 0;
+      auto starving = clock::now();
+      while (true == ids.empty() && false == giveUp)
+      {
+        if (true == freed->pop(id)) ids.push_back(id);
+        else if (clock::now() - starving > chrono::seconds(5))
+        {
+          fprintf(stderr, "loadgen: all %u trader ids are held by resting orders for 5 s, giving up (balance --buy or raise --ioc)\n", IDS);
+          giveUp = true;
+        }
+        else
+        {
+          stalls++;
+          this_thread::yield();
+        }
+      }
+      if (true == giveUp) break;
+      id = ids.back();
+      ids.pop_back();
+
+      InputOrder order{static_cast<char>('A' + instrument(rng)), id, qty(rng), (unit(rng) < o.buyRatio) ? Buy : Sell};
+      if (unit(rng) < o.iocRatio) order.type = ImmediateOrCancel;
+      intended[id] = when;
+      orderQty[id] = order.qty;
+
+      // a closed exchange never answers it, nothing more to send
+      if (false == ex.engine.q.push(order))
+      {
+        fprintf(stderr, "loadgen: the exchange refused an order, giving up\n");
+        refused++;
+        giveUp = true;
+        break;
+      }
+      sent = i + 1;
+
+      while (true == freed->pop(id)) ids.push_back(id);
+    }
+  });
+
+  // consumer: first event of an id is the response to its order
+  uint64_t eventsCount = 0;
+  auto release = [&](uint16_t id){
+    state[id] = Free;
+    freed->forcePush(id);
+  };
+  // gives up when no event comes for a while, whatever the generator does
+  const auto idle = max<chrono::nanoseconds>(chrono::seconds(5), chrono::nanoseconds(10 * interval));
+  auto lastEvent = clock::now();
+  while (acked.load(memory_order_relaxed) < o.orders && false == giveUp)
+  {
+    Event e;
+    if (false == events->pop(e))
+    {
+      if (clock::now() - lastEvent > idle)
+      {
+        fprintf(stderr, "loadgen: no events for %.1f s, giving up\n", chrono::duration<double>(idle).count());
+        giveUp = true;
+      }
+      this_thread::yield();
+      continue;
+    }
+    lastEvent = clock::now();
+    eventsCount++;
+    uint16_t id = e.trader;
+
+    if (Free == state[id])
+    {
+      auto now = clock::now();
+      histogram.record(chrono::duration_cast<chrono::nanoseconds>(now - intended[id]).count(), interval, correct);
+      acked.fetch_add(1, memory_order_release);
+
+      if (OrderPlaced == e.type) state[id] = Resting;
+      else if (Exec == e.type && e.qty != orderQty[id]) state[id] = AwaitCancel;
+      else release(id);
+    }
+    else if (Exec == e.type || Cancelled == e.type)
+    {
+      release(id);
+    }
+  }
+  auto end = clock::now();
+
+  giveUp = true;
+  generator.join();
+
+  // nobody reads the ring any more, a stalled exchange may still flood it
+  ex.stopDiscarding(*events);
+  if (nullptr != capture) capture->stop();
+
+  double seconds = chrono::duration<double>(end - start).count();
+  uint64_t done = acked.load();
+  printf("mode            %s loop, rate %s\n", o.closedLoop ? "closed" : "open", (0 != o.rate) ? to_string(static_cast<uint64_t>(o.rate)).c_str() : "max");
+  printf("orders          %" PRIu64 " sent, %" PRIu64 " acknowledged, %" PRIu64 " events\n", sent, done, eventsCount);
+  printf("duration        %.3f s\n", seconds);
+  printf("throughput      %.0f orders/s, %.0f events/s\n", done / seconds, eventsCount / seconds);
+  printf("generator stalls %" PRIu64 " (no free trader id)\n", stalls);
+  if (0 != refused) printf("refused         %" PRIu64 " orders (exchange closed)\n", refused);
+  printf("latency (us)%s\n", correct ? ", corrected for coordinated omission" : "");
+  for (double p : {50.0, 90.0, 99.0, 99.9, 99.99, 100.0})
+  {
+    printf("  p%-8g %.3f\n", p, histogram.percentile(p) / 1000.0);
+  }
+
+  if (nullptr != capture)
+  {
+    printf("captured        inputs up to seq %" PRIu64 ", events up to seq %" PRIu64 " in %s\n", capture->inputsSeq, capture->eventsSeq, o.capture.c_str());
+    if (true == capture->failed) printf("capture failed  %s, %" PRIu64 " records dropped\n", capture->error.c_str(), capture->dropped.load());
+  }
+
+  delete freed;
+  delete events;
+  return (done == o.orders) ? 0 : 2;
+}
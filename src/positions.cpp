@@ -0,0 +1,59 @@
+#include <positions.h>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+using namespace std;
+
+const Position PositionTable::NONE[INSTRUMENTS] = {};
+
+PositionTable::PositionTable() : seq(TRADERS), slots(TRADERS), table(nullptr), used(0)
+{
+  for (auto& s : seq) s.store(0, memory_order_relaxed);
+  for (auto& s : slots) s.store(0, memory_order_relaxed);
+
+  // zeroed pages, backed only once a trader touches its row
+  table = static_cast<Position*>(calloc(size_t(SLOTS) * INSTRUMENTS, sizeof(Position)));
+  if (nullptr == table) throw bad_alloc();
+}
+
+PositionTable::~PositionTable()
+{
+  free(table);
+}
+
+Position PositionTable::read(char instrument, uint16_t trader) const
+{
+  Position out;
+  uint32_t before = 0;
+  do
+  {
+    while ((before = seq[trader].load(memory_order_acquire)) & 1)
+    {
+      this_thread::yield();
+    }
+    uint32_t s = slots[trader].load(memory_order_acquire);
+    const Position* p = (0 == s) ? NONE : table + size_t(s - 1) * INSTRUMENTS;
+    out = p[static_cast<unsigned char>(instrument)];
+    atomic_thread_fence(memory_order_acquire);
+  }
+  while (before != seq[trader].load(memory_order_relaxed));
+
+  return out;
+}
+
+void PositionTable::read(uint16_t trader, Position* out) const
+{
+  uint32_t before = 0;
+  do
+  {
+    while ((before = seq[trader].load(memory_order_acquire)) & 1)
+    {
+      this_thread::yield();
+    }
+    uint32_t s = slots[trader].load(memory_order_acquire);
+    memcpy(out, (0 == s) ? NONE : table + size_t(s - 1) * INSTRUMENTS, INSTRUMENTS * sizeof(Position));
+    atomic_thread_fence(memory_order_acquire);
+  }
+  while (before != seq[trader].load(memory_order_relaxed));
+}
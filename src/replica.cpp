@@ -0,0 +1,406 @@
+#include <replica.h>
+#include <capture.h>
+#include <checksum.h>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <system_error>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+ReplicationRecord encodeRecord(const SequencedInput& input)
+{
+  const InputOrder& order = input.order;
+  ReplicationRecord record;
+  memset(&record, 0, sizeof(record));
+  record.seq = input.seq;
+  record.time = input.time;
+  record.qty = order.qty;
+  record.displayQty = order.displayQty;
+  record.trader = order.trader;
+  record.instrument = order.instrument;
+  record.side = order.side;
+  record.type = order.type;
+  record.crc = crc32c(0, &record, offsetof(ReplicationRecord, crc));
+  return record;
+}
+
+bool decodeRecord(const ReplicationRecord& record, SequencedInput& input)
+{
+  if (record.crc != crc32c(0, &record, offsetof(ReplicationRecord, crc))) return false;
+
+  input.seq = record.seq;
+  input.time = record.time;
+  input.order = InputOrder{record.instrument, record.trader, record.qty, static_cast<Side>(record.side)};
+  input.order.type = static_cast<OrderType>(record.type);
+  input.order.displayQty = record.displayQty;
+  return true;
+}
+
+static sockaddr_un socketAddress(const string& path)
+{
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+ReplicationSender::ReplicationSender(const string& path, bool sync) :
+  socketPath(path), synchronous(sync), fd(-1), seq(0), sent(0), dropped(0), highWater(0), acked(0), held(0), heldNs(0), timeouts(0), connected(false),
+  holding(false), ackTimeout(100), ack{}, ackBytes(0) {}
+
+ReplicationSender::~ReplicationSender()
+{
+  stop();
+  disconnect();
+}
+
+void ReplicationSender::attach(Exchange& ex)
+{
+  InputTap tap{&inputs, &dropped};
+  if (true == synchronous)
+  {
+    tap.acked = &acked;
+    tap.live = &holding;
+    tap.held = &held;
+    tap.heldNs = &heldNs;
+  }
+  ex.engine.inputTaps.push_back(tap);
+}
+
+bool ReplicationSender::connect()
+{
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return false;
+
+  sockaddr_un address = socketAddress(socketPath);
+  if (0 != ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+  {
+    disconnect();
+    return false;
+  }
+
+  // a new standby acks from where it is, not from where the last one was
+  acked.store(seq, memory_order_release);
+  connected.store(true, memory_order_release);
+  holding.store(synchronous, memory_order_release);
+  return true;
+}
+
+void ReplicationSender::disconnect()
+{
+  if (fd < 0) return;
+  holding.store(false, memory_order_release);
+  connected.store(false, memory_order_release);
+  ::close(fd);
+  fd = -1;
+  ackBytes = 0;
+}
+
+bool ReplicationSender::waitAcked(uint64_t s, chrono::milliseconds timeout) const
+{
+  auto deadline = chrono::steady_clock::now() + timeout;
+  while (acked.load(memory_order_acquire) < s)
+  {
+    if (chrono::steady_clock::now() > deadline) return false;
+    this_thread::sleep_for(chrono::microseconds(100));
+  }
+  return true;
+}
+
+void ReplicationSender::readAcks()
+{
+  char buffer[64 * sizeof(uint64_t)];
+  while (fd >= 0)
+  {
+    memcpy(buffer, ack, ackBytes);
+    ssize_t n = recv(fd, buffer + ackBytes, sizeof(buffer) - ackBytes, MSG_DONTWAIT);
+    if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)) return;
+    if (n <= 0)
+    {
+      disconnect();
+      return;
+    }
+
+    // only the latest one matters
+    size_t bytes = ackBytes + n, count = bytes / sizeof(uint64_t);
+    if (0 != count)
+    {
+      uint64_t last;
+      memcpy(&last, buffer + (count - 1) * sizeof(uint64_t), sizeof(last));
+      acked.store(last, memory_order_release);
+    }
+    ackBytes = bytes % sizeof(uint64_t);
+    memcpy(ack, buffer + count * sizeof(uint64_t), ackBytes);
+  }
+}
+
+void ReplicationSender::run()
+{
+  const size_t BATCH = 256;
+  SequencedInput batch[BATCH];
+  ReplicationRecord records[BATCH];
+  auto retry = chrono::steady_clock::time_point(), ackedAt = retry;
+  uint64_t lastAcked = 0;
+
+  // drains the ring before leaving, closing the socket tells the standby
+  while (true)
+  {
+    bool last = isShutdown.load(memory_order_acquire);
+    size_t n = inputs.pop(batch, BATCH);
+    auto now = chrono::steady_clock::now();
+
+    // a standby that stopped acking does not hold up the primary for long
+    uint64_t done = acked.load(memory_order_acquire);
+    if (done >= seq || done != lastAcked) ackedAt = now;
+    lastAcked = done;
+    bool hold = (fd >= 0 && true == synchronous && now - ackedAt <= ackTimeout);
+    if (hold != holding.load(memory_order_relaxed))
+    {
+      if (false == hold && fd >= 0) timeouts.fetch_add(1, memory_order_relaxed);
+      holding.store(hold, memory_order_release);
+    }
+
+    if (0 == n)
+    {
+      if (true == last) break;
+      if (fd >= 0 && acked.load(memory_order_relaxed) < seq) readAcks();
+
+      // a synchronous primary waits for the standby only once it is there
+      if (true == synchronous && fd < 0 && now >= retry && false == connect()) retry = now + chrono::milliseconds(10);
+      this_thread::yield();
+      continue;
+    }
+
+    for (size_t i = 0; i < n; i++) records[i] = encodeRecord(batch[i]);
+    seq = batch[n - 1].seq;
+    highWater.store(seq, memory_order_release);
+
+    // no standby: drop, it catches up from the capture
+    if (fd < 0 && now >= retry && false == connect()) retry = now + chrono::milliseconds(10);
+    if (fd < 0)
+    {
+      dropped += n;
+      continue;
+    }
+
+    const char* p = reinterpret_cast<const char*>(records);
+    size_t left = n * sizeof(ReplicationRecord);
+    while (0 != left)
+    {
+      ssize_t written = send(fd, p, left, MSG_NOSIGNAL);
+      if (written < 0 && EINTR == errno) continue;
+      if (written <= 0)
+      {
+        disconnect();
+        break;
+      }
+      p += written;
+      left -= written;
+    }
+    if (fd < 0) dropped += n;
+    else sent += n;
+    readAcks();
+  }
+
+  disconnect();
+}
+
+Standby::Standby(Exchange& exchange, const string& path, const string& dir) :
+  ex(exchange), socketPath(path), captureDir(dir), listenFd(-1), nextSeq(1), lastSeq(0),
+  gapSince(), applied(0), caughtUp(0), missed(0), connected(false), primaryGone(false), failed(false)
+{
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) throw system_error(errno, generic_category(), socketPath);
+
+  unlink(socketPath.c_str());
+  sockaddr_un address = socketAddress(socketPath);
+  if (0 != ::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) || 0 != listen(listenFd, 1))
+  {
+    int error = errno;
+    ::close(listenFd);
+    throw system_error(error, generic_category(), socketPath);
+  }
+
+  // the clients are connected to the primary, not to us
+  ex.engine.sink.discard = true;
+}
+
+Standby::~Standby()
+{
+  stop();
+  ::close(listenFd);
+  unlink(socketPath.c_str());
+}
+
+void Standby::apply(const InputOrder& o, uint64_t time)
+{
+  ex.engine.inputTime = time;
+  ex.engine.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty);
+  ex.engine.inputTime = 0;
+
+  // once promoted the engine goes on with the sequence of the primary
+  ex.engine.inputSeq = nextSeq++;
+  applied.fetch_add(1, memory_order_relaxed);
+}
+
+void Standby::sendAck(int fd)
+{
+  uint64_t seq = nextSeq - 1;
+  const char* p = reinterpret_cast<const char*>(&seq);
+
+  // skipped when the socket is full, the next one says more; never split
+  ssize_t n = send(fd, p, sizeof(seq), MSG_DONTWAIT | MSG_NOSIGNAL);
+  for (size_t done = (n > 0) ? n : 0; 0 != done && done < sizeof(seq); )
+  {
+    n = send(fd, p + done, sizeof(seq) - done, MSG_NOSIGNAL);
+    if (n <= 0 && EINTR != errno) break;
+    if (n > 0) done += n;
+  }
+}
+
+void Standby::replayCapture(uint64_t seq)
+{
+  for (auto& path : captureSegments(captureDir, "inputs"))
+  {
+    SegmentReader reader;
+    if (nextSeq >= seq || false == reader.open(path)) continue;
+
+    // the seq column is sorted, with gaps where the capture dropped inputs
+    const uint64_t* seqs = reader.data<uint64_t>(SeqColumn);
+    const uint64_t* times = reader.data<uint64_t>(TimeColumn);
+    uint64_t rows = reader.rows();
+    for (uint64_t row = lower_bound(seqs, seqs + rows, nextSeq) - seqs; row < rows && nextSeq < seq && seqs[row] == nextSeq; row++)
+    {
+      apply(reader.input(row), times[row]);
+      caughtUp.fetch_add(1, memory_order_relaxed);
+    }
+  }
+}
+
+bool Standby::applyPending()
+{
+  while (false == pending.empty())
+  {
+    const SequencedInput& next = pending.front();
+    replayCapture(next.seq);
+    if (next.seq > nextSeq) return false;
+    if (next.seq == nextSeq) apply(next.order, next.time);
+    pending.pop_front();
+  }
+  return true;
+}
+
+void Standby::catchUp(chrono::steady_clock::time_point now)
+{
+  // the capture thread of the primary may still be writing the gap
+  size_t before = pending.size();
+  if (true == applyPending())
+  {
+    failed = false;
+    return;
+  }
+  if (pending.size() != before) gapSince = now;
+  if (false == failed && now - gapSince <= chrono::seconds(1)) return;
+
+  failed = true;
+  missed.fetch_add(pending.size(), memory_order_relaxed);
+  pending.clear();
+}
+
+void Standby::run()
+{
+  const size_t RECORDS = 256;
+  ReplicationRecord records[RECORDS];
+  char* buffer = reinterpret_cast<char*>(records);
+  size_t have = 0;
+  int fd = -1;
+
+  while (false == isShutdown.load(memory_order_acquire))
+  {
+    // behind a gap the capture is looked at again every ms
+    pollfd p{(fd < 0) ? listenFd : fd, POLLIN, 0};
+    int ready = poll(&p, 1, pending.empty() ? 10 : 1);
+    if (ready > 0 && fd < 0)
+    {
+      fd = accept(listenFd, nullptr, nullptr);
+      have = 0;
+      connected = (fd >= 0);
+      continue;
+    }
+
+    size_t count = 0;
+    if (ready > 0)
+    {
+      ssize_t n = read(fd, buffer + have, sizeof(records) - have);
+      if (n <= 0)
+      {
+        ::close(fd);
+        fd = -1;
+        connected = false;
+        primaryGone = true;
+      }
+      else have += n;
+      count = have / sizeof(ReplicationRecord);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+      // a damaged record shows up as a gap at the next one
+      SequencedInput input;
+      if (false == decodeRecord(records[i], input) || records[i].seq < nextSeq) continue;
+      lastSeq = max(lastSeq, records[i].seq);
+
+      if (true == pending.empty() && records[i].seq == nextSeq)
+      {
+        apply(input.order, input.time);
+        continue;
+      }
+      if (true == pending.empty()) gapSince = chrono::steady_clock::now();
+      pending.push_back(input);
+    }
+    if (false == pending.empty()) catchUp(chrono::steady_clock::now());
+    if (fd < 0) continue;
+    if (0 != count) sendAck(fd);
+
+    // hanging up lets a synchronous primary go on, it reconnects
+    if (true == failed)
+    {
+      ::close(fd);
+      fd = -1;
+      connected = false;
+      continue;
+    }
+
+    size_t used = count * sizeof(ReplicationRecord);
+    memmove(buffer, buffer + used, have - used);
+    have -= used;
+  }
+
+  if (fd >= 0) ::close(fd);
+  connected = false;
+}
+
+bool Standby::promote()
+{
+  // wakes up the replica thread waiting for the primary to reconnect
+  ::shutdown(listenFd, SHUT_RDWR);
+  stop();
+
+  // the primary may have taken orders it never sent, the capture has them
+  applyPending();
+  replayCapture(UINT64_MAX);
+  failed = (nextSeq <= lastSeq);
+  if (true == failed) return false;
+
+  ex.engine.sink.discard = false;
+  ex.start();
+  return true;
+}
@@ -0,0 +1,60 @@
+#include <risk.h>
+#include <cstdlib>
+#include <new>
+using namespace std;
+
+PreTradeRisk::PreTradeRisk() : 
+  limits(TRADERS),
+  rates(TRADERS, RateWindow{0, 0}),
+  killed(TRADERS),
+  killSwitch(false),
+  open(nullptr)
+{
+  for (uint32_t trader = 0; trader < TRADERS; trader++) setLimits(trader, TraderLimits{UINT32_MAX, UINT64_MAX, 0, 0});
+  for (auto& k : killed) k.store(false, memory_order_relaxed);
+
+  // zeroed pages, backed only once a trader touches its row
+  open = static_cast<uint64_t*>(calloc(size_t(SLOTS) * INSTRUMENTS, sizeof(uint64_t)));
+  if (nullptr == open) throw bad_alloc();
+}
+
+PreTradeRisk::~PreTradeRisk()
+{
+  free(open);
+}
+
+void PreTradeRisk::setLimits(uint16_t trader, const TraderLimits& traderLimits)
+{
+  AtomicLimits& limit = limits[trader];
+  limit.maxOrderQty.store(traderLimits.maxOrderQty, memory_order_relaxed);
+  limit.maxOpenQty.store(traderLimits.maxOpenQty, memory_order_relaxed);
+  limit.maxOrdersPerSec.store(traderLimits.maxOrdersPerSec, memory_order_relaxed);
+  limit.maxPosition.store(traderLimits.maxPosition, memory_order_relaxed);
+}
+
+TraderLimits PreTradeRisk::getLimits(uint16_t trader) const
+{
+  const AtomicLimits& limit = limits[trader];
+  return TraderLimits{limit.maxOrderQty.load(memory_order_relaxed), limit.maxOpenQty.load(memory_order_relaxed),
+                      limit.maxOrdersPerSec.load(memory_order_relaxed), limit.maxPosition.load(memory_order_relaxed)};
+}
+
+void PreTradeRisk::kill(uint16_t trader)
+{
+  killed[trader].store(true, memory_order_relaxed);
+}
+
+void PreTradeRisk::resume(uint16_t trader)
+{
+  killed[trader].store(false, memory_order_relaxed);
+}
+
+void PreTradeRisk::killAll()
+{
+  killSwitch.store(true, memory_order_relaxed);
+}
+
+void PreTradeRisk::resumeAll()
+{
+  killSwitch.store(false, memory_order_relaxed);
+}
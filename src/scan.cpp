@@ -0,0 +1,102 @@
+#include <scan.h>
+#include <immintrin.h>
+using namespace std;
+
+// rows from `from` (multiple of 64 or the last partial word) to n
+template <typename T>
+static void filterTail(const T* column, size_t from, size_t n, T value, uint64_t* mask)
+{
+  for (size_t i = from; i < n; i++)
+  {
+    if (column[i] != value) mask[i / 64] &= ~(uint64_t(1) << (i % 64));
+  }
+}
+
+void filterU8Scalar(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask)
+{
+  filterTail(column, 0, n, value, mask);
+}
+
+void filterU16Scalar(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask)
+{
+  filterTail(column, 0, n, value, mask);
+}
+
+// 64 rows (one mask word) per step, 16 rows per compare.
+__attribute__((target("sse4.2")))
+void filterU8Sse42(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask)
+{
+  const __m128i v = _mm_set1_epi8(static_cast<char>(value));
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    const __m128i* p = reinterpret_cast<const __m128i*>(column + i);
+    uint64_t m = static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), v)))
+               | static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), v))) << 16
+               | static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), v))) << 32
+               | static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 3), v))) << 48;
+    mask[i / 64] &= m;
+  }
+  filterTail(column, i, n, value, mask);
+}
+
+// 16 bit compares packed to bytes (saturated 0xffff -> 0xff) for movemask.
+__attribute__((target("sse4.2")))
+void filterU16Sse42(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask)
+{
+  const __m128i v = _mm_set1_epi16(static_cast<short>(value));
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    const __m128i* p = reinterpret_cast<const __m128i*>(column + i);
+    uint64_t m = 0;
+    for (int k = 0; k < 4; k++)
+    {
+      __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * k), v);
+      __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(p + 2 * k + 1), v);
+      m |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_packs_epi16(a, b))) << (16 * k);
+    }
+    mask[i / 64] &= m;
+  }
+  filterTail(column, i, n, value, mask);
+}
+
+__attribute__((target("avx2")))
+void filterU8Avx2(const uint8_t* column, size_t n, uint8_t value, uint64_t* mask)
+{
+  const __m256i v = _mm256_set1_epi8(static_cast<char>(value));
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    const __m256i* p = reinterpret_cast<const __m256i*>(column + i);
+    uint64_t lo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p), v)));
+    uint64_t hi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), v)));
+    mask[i / 64] &= lo | (hi << 32);
+  }
+  filterTail(column, i, n, value, mask);
+}
+
+// packs works within 128 bit lanes, the permute puts the rows back in order.
+__attribute__((target("avx2")))
+void filterU16Avx2(const uint16_t* column, size_t n, uint16_t value, uint64_t* mask)
+{
+  const __m256i v = _mm256_set1_epi16(static_cast<short>(value));
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    const __m256i* p = reinterpret_cast<const __m256i*>(column + i);
+    uint64_t m = 0;
+    for (int k = 0; k < 2; k++)
+    {
+      __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * k), v);
+      __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 2 * k + 1), v);
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8);
+      m |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(packed))) << (32 * k);
+    }
+    mask[i / 64] &= m;
+  }
+  filterTail(column, i, n, value, mask);
+}
+
+FilterU8Kernel filterU8 = filterU8Scalar;
+FilterU16Kernel filterU16 = filterU16Scalar;
@@ -0,0 +1,147 @@
+#include <scheduler.h>
+#include <algorithm>
+using namespace std;
+
+void TraderScheduler::Worker::run()
+{
+  // yields after a round of polls without events, parks after PARK_ROUNDS
+  size_t idle = 0, tools = 0, rounds = 0;
+  while (false == isShutdown.load(memory_order_acquire))
+  {
+    TradingTool* tool = nullptr;
+    bool taken = scheduler.take(index, tool);
+    if (true == taken)
+    {
+      bool busy = tool->poll(BUDGET);
+      tools = scheduler.give(index, tool);
+      idle = busy ? 0 : idle + 1;
+      if (true == busy) rounds = 0;
+      if (idle < tools) continue;
+    }
+
+    idle = 0;
+    if (nullptr != scheduler.doorbell && ++rounds >= PARK_ROUNDS)
+    {
+      rounds = 0;
+      park(taken ? tools : 0);
+    }
+    else
+    {
+      this_thread::yield();
+    }
+  }
+}
+
+void TraderScheduler::Worker::park(size_t tools)
+{
+  Doorbell& doorbell = *scheduler.doorbell;
+  uint64_t seen = doorbell.prepare();
+
+  // events pushed before prepare are found here, the later ones ring
+  bool busy = false;
+  for (size_t i = 0; i < tools && false == busy; i++)
+  {
+    TradingTool* tool = nullptr;
+    if (false == scheduler.take(index, tool)) break;
+    busy = tool->poll(BUDGET);
+    scheduler.give(index, tool);
+  }
+
+  if (true == busy) doorbell.cancel();
+  else doorbell.wait(seen, isShutdown);
+}
+
+TraderScheduler::TraderScheduler(size_t workersCount, bool steal) : next(0), stealing(steal), doorbell(nullptr)
+{
+  for (size_t i = 0; i < workersCount; i++)
+  {
+    workers.emplace_back(new Worker(*this, i));
+  }
+}
+
+TraderScheduler::~TraderScheduler()
+{
+  stop();
+}
+
+void TraderScheduler::add(TradingTool* tool)
+{
+  workers[next++ % workers.size()]->tasks.push_back(tool);
+}
+
+void TraderScheduler::start()
+{
+  for (auto& worker : workers) worker->start();
+}
+
+void TraderScheduler::attach(Exchange& ex)
+{
+  // the Notifier and the workers read them without a lock
+  if (nullptr != ex.notif.the || true == started()) throw logic_error("TraderScheduler::attach after start");
+  ex.notif.ringing = true;
+  doorbell = &ex.notif.doorbell;
+}
+
+void TraderScheduler::stop()
+{
+  // the parked workers see the flag when they wake up; not started, the
+  // exchange may be gone already
+  bool parked = (nullptr != doorbell && true == started());
+  for (auto& worker : workers) worker->isShutdown.store(true, memory_order_release);
+  if (true == parked) doorbell->wakeAll();
+  for (auto& worker : workers) worker->stop();
+}
+
+bool TraderScheduler::started() const
+{
+  return any_of(workers.begin(), workers.end(), [](const unique_ptr<Worker>& worker){ return nullptr != worker->the; });
+}
+
+bool TraderScheduler::take(size_t worker, TradingTool*& tool)
+{
+  Worker& own = *workers[worker];
+  if (false == stealing)
+  {
+    if (true == own.tasks.empty()) return false;
+    tool = own.tasks.front();
+    own.tasks.pop_front();
+    return true;
+  }
+
+  {
+    unique_lock<mutex> lm(own.m);
+    if (false == own.tasks.empty())
+    {
+      tool = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+
+  for (size_t i = 1; i < workers.size(); i++)
+  {
+    Worker& victim = *workers[(worker + i) % workers.size()];
+    unique_lock<mutex> lm(victim.m);
+    if (false == victim.tasks.empty())
+    {
+      tool = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t TraderScheduler::give(size_t worker, TradingTool* tool)
+{
+  Worker& own = *workers[worker];
+  if (false == stealing)
+  {
+    own.tasks.push_back(tool);
+    return own.tasks.size();
+  }
+
+  unique_lock<mutex> lm(own.m);
+  own.tasks.push_back(tool);
+  return own.tasks.size();
+}
@@ -0,0 +1,96 @@
+#include <sweep.h>
+#include <immintrin.h>
+using namespace std;
+
+size_t sweepScalar(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed)
+{
+  uint64_t total = 0;
+  size_t i = 0;
+  for (; i < n && total + qty[i] <= available; i++)
+  {
+    total += qty[i];
+  }
+  consumed = total;
+  return i;
+}
+
+// 16 orders per step: quantities widened to 64 bit lanes and summed, the
+// block sums don't depend on each other, only the running total does. The
+// block where the total goes over the available quantity is finished by the
+// scalar prefix scan.
+__attribute__((target("avx2")))
+size_t sweepAvx2(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed)
+{
+  uint64_t total = 0;
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16)
+  {
+    const __m128i* p = reinterpret_cast<const __m128i*>(qty + i);
+    __m256i a = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm_loadu_si128(p)), _mm256_cvtepu32_epi64(_mm_loadu_si128(p + 1)));
+    __m256i b = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm_loadu_si128(p + 2)), _mm256_cvtepu32_epi64(_mm_loadu_si128(p + 3)));
+    __m256i x = _mm256_add_epi64(a, b);
+    __m128i h = _mm_add_epi64(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    uint64_t block = static_cast<uint64_t>(_mm_cvtsi128_si64(h)) + static_cast<uint64_t>(_mm_extract_epi64(h, 1));
+
+    if (total + block > available) break;
+    total += block;
+  }
+
+  uint64_t tail = 0;
+  size_t k = sweepScalar(qty + i, n - i, available - total, tail);
+  consumed = total + tail;
+  return i + k;
+}
+
+// 8 orders per step, same as the AVX2 version with 128 bit registers.
+__attribute__((target("sse4.2")))
+size_t sweepSse42(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed)
+{
+  uint64_t total = 0;
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    const __m128i* p = reinterpret_cast<const __m128i*>(qty + i);
+    __m128i lo = _mm_loadu_si128(p), hi = _mm_loadu_si128(p + 1);
+    __m128i a = _mm_add_epi64(_mm_cvtepu32_epi64(lo), _mm_cvtepu32_epi64(_mm_srli_si128(lo, 8)));
+    __m128i b = _mm_add_epi64(_mm_cvtepu32_epi64(hi), _mm_cvtepu32_epi64(_mm_srli_si128(hi, 8)));
+    __m128i h = _mm_add_epi64(a, b);
+    uint64_t block = static_cast<uint64_t>(_mm_cvtsi128_si64(h)) + static_cast<uint64_t>(_mm_extract_epi64(h, 1));
+
+    if (total + block > available) break;
+    total += block;
+  }
+
+  uint64_t tail = 0;
+  size_t k = sweepScalar(qty + i, n - i, available - total, tail);
+  consumed = total + tail;
+  return i + k;
+}
+
+// 32 orders per step with 512 bit registers.
+__attribute__((target("avx512f")))
+size_t sweepAvx512(const uint32_t* qty, size_t n, uint64_t available, uint64_t& consumed)
+{
+  uint64_t total = 0;
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32)
+  {
+    const __m256i* p = reinterpret_cast<const __m256i*>(qty + i);
+    __m512i a = _mm512_add_epi64(_mm512_cvtepu32_epi64(_mm256_loadu_si256(p)), _mm512_cvtepu32_epi64(_mm256_loadu_si256(p + 1)));
+    __m512i b = _mm512_add_epi64(_mm512_cvtepu32_epi64(_mm256_loadu_si256(p + 2)), _mm512_cvtepu32_epi64(_mm256_loadu_si256(p + 3)));
+    uint64_t block = static_cast<uint64_t>(_mm512_reduce_add_epi64(_mm512_add_epi64(a, b)));
+
+    if (total + block > available) break;
+    total += block;
+  }
+
+  uint64_t tail = 0;
+  size_t k = sweepScalar(qty + i, n - i, available - total, tail);
+  consumed = total + tail;
+  return i + k;
+}
+
+SweepKernel sweepOrders = sweepScalar;
@@ -16,7 +16,7 @@ void threadable::start()
 
 void threadable::stop() 
 {
-  isShutdown = true;
+  isShutdown.store(true, memory_order_release);
   if (the) the->join();
   delete the;
   the = nullptr;
@@ -0,0 +1,99 @@
+#include <traderpool.h>
+using namespace std;
+
+TraderPool::TraderPool(Exchange& ex, size_t workersCount) : exchange(ex), scheduler(workersCount, true), takers(0), finishedTakers(0), refused(0)
+{
+  scheduler.attach(ex);
+}
+
+TraderPool::~TraderPool()
+{
+  stop();
+}
+
+TradingTool* TraderPool::addAgent(uint16_t id, function<void(TradingTool*)> init, function<void(TradingTool*,Event)> algo)
+{
+  TradingTool* agent = new TradingTool(id);
+  agent->init = init;
+  agent->algo = algo;
+  agent->connectTo(exchange);
+  agents.emplace_back(agent);
+  scheduler.add(agent);
+  return agent;
+}
+
+void TraderPool::addMarketMakers(uint16_t firstId, uint16_t count, const MarketMakerParams& params)
+{
+  for (uint16_t id = firstId; id < firstId + count; id++)
+  {
+    // a closed exchange refuses the rest of the quotes
+    auto init = [this, params](TradingTool* me){
+      for (uint32_t i = 0; i < params.orders; i++)
+      {
+        if (false == me->q->push(InputOrder{params.instrument, me->id, params.qty, params.side})) refused++;
+      }
+    };
+    auto algo = [this, params](TradingTool* me, Event e){
+      if (Exec == e.type && false == me->q->push(InputOrder{params.instrument, me->id, params.qty, e.side}))
+      {
+        refused++;
+      }
+    };
+    addAgent(id, init, algo);
+  }
+}
+
+void TraderPool::addTakers(uint16_t firstId, uint16_t count, const TakerParams& params)
+{
+  for (uint16_t id = firstId; id < firstId + count; id++)
+  {
+    auto sent = make_shared<uint32_t>(0);
+    auto filled = make_shared<uint64_t>(0);
+    auto send = [this, params, sent, filled](TradingTool* me){
+      Side side = (None != params.side) ? params.side : (((me->id + *sent) % 2) ? Sell : Buy);
+      *filled = 0;
+
+      // a closed exchange takes no more orders, no event ends this one
+      if (false == me->q->push(InputOrder{params.instrument, me->id, params.qty, side, params.type, params.displayQty}))
+      {
+        *sent = params.orders;
+        refused++;
+        finishedTakers++;
+        return;
+      }
+      (*sent)++;
+    };
+    auto algo = [this, params, sent, filled, send](TradingTool* me, Event e){
+      // an order ends executed in full (an iceberg in slices), Cancelled or Rejected
+      if (Exec == e.type) *filled += e.qty;
+      if (params.qty == *filled || Cancelled == e.type || Rejected == e.type)
+      {
+        if (*sent < params.orders)
+        {
+          send(me);
+        }
+        else
+        {
+          finishedTakers++;
+        }
+      }
+    };
+    addAgent(id, send, algo);
+    takers++;
+  }
+}
+
+bool TraderPool::takersDone() const
+{
+  return finishedTakers.load() == takers.load();
+}
+
+void TraderPool::start()
+{
+  scheduler.start();
+}
+
+void TraderPool::stop()
+{
+  scheduler.stop();
+}
@@ -1,7 +1,7 @@
 #include <tradingtool.h>
 
 
-TradingTool::TradingTool(uint16_t identifier) : id(identifier) {}
+TradingTool::TradingTool(uint16_t identifier) : id(identifier), initialized(false) {}
 
 void TradingTool::connectTo(Exchange& ex)
 {
@@ -11,18 +11,30 @@ void TradingTool::connectTo(Exchange& ex)
 
 void TradingTool::run() 
 {
-  if (init) init(this);
-  while (false == isShutdown)
+  while (false == isShutdown.load(memory_order_acquire))
   {
-    Event event;
-    if (true == events.pop(event))
-    {
-      if (algo) algo(this,event);
-    }
-    else
+    if (false == poll(1))
     {
       this_thread::yield(); // not needed if spin lock
     }
   }
 }
 
+bool TradingTool::poll(size_t budget) 
+{
+  if (false == initialized)
+  {
+    initialized = true;
+    if (init) init(this);
+    return true;
+  }
+
+  size_t n = 0;
+  Event event;
+  while (n < budget && true == events.pop(event))
+  {
+    if (algo) algo(this,event);
+    n++;
+  }
+  return 0 != n;
+}
@@ -7,6 +7,20 @@
 #include <connectors.h>
 #include <exchange.h>
 #include <tradingtool.h>
+#include <scheduler.h>
+#include <traderpool.h>
+#include <sweep.h>
+#include <checksum.h>
+#include <cpu.h>
+#include <scan.h>
+#include <capture.h>
+#include <replica.h>
+#include <histogram.h>
+#include <random>
+#include <map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 //tests
 #include "gtest/gtest.h"
@@ -200,6 +214,676 @@ TEST(MatchingEngineTest, OrderSlicing)
 }
 
 
+TEST(MatchingEngineTest, ImmediateOrCancel)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  eng.placeOrder('H', Buy, 1, 10, ImmediateOrCancel);
+  eng.placeOrder('H', Sell, 2, 30);
+  eng.placeOrder('H', Buy, 3, 10, ImmediateOrCancel);
+  eng.placeOrder('H', Buy, 4, 50, ImmediateOrCancel);
+
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Cancelled,'H',1,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',2,30,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,30,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',3,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,20,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,30,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',4,20,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Cancelled,'H',4,30,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,0,None}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+  ASSERT_EQ (0u, eng.risk.openQty('H', 1));
+  ASSERT_EQ (0u, eng.risk.openQty('H', 4));
+}
+
+TEST(MatchingEngineTest, FillOrKill)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  eng.placeOrder('H', Sell, 1, 100);
+  eng.placeOrder('H', Buy, 2, 150, FillOrKill);
+  eng.placeOrder('H', Buy, 3, 60, FillOrKill);
+  eng.placeOrder('H', Sell, 4, 10, FillOrKill);
+
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,100,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,100,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Cancelled,'H',2,150,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',3,60,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,40,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Cancelled,'H',4,10,Sell}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+
+  // hidden iceberg quantity is available to fill or kill orders
+  eng.placeOrder('H', Sell, 5, 100, Iceberg, 10);
+  eng.placeOrder('H', Buy, 6, 140, FillOrKill);
+
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',5,100,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,50,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,100,Sell}) == event);
+  for (int i = 0; i < 10; i++)
+  {
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',5,10,Sell}) == event);
+    if (9 != i)
+    {
+      ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',5,10,Sell}) == event);
+    }
+  }
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',6,140,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,0,None}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+TEST(MatchingEngineTest, IcebergOrders)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  eng.marketView.enabled = true;
+  Event event;
+  BookDepth depth;
+
+  eng.placeOrder('H', Buy, 1, 50, Iceberg, 20);
+  eng.placeOrder('H', Buy, 2, 30);
+
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,50,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,20,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',2,30,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,50,Buy}) == event);
+  ASSERT_TRUE (ex.depth('H', depth));
+  ASSERT_EQ (2u, depth.size);
+  ASSERT_EQ (20u, depth.orders[0].qty);
+
+  // refreshed slice goes behind trader 2, a new order with its own id
+  eng.placeOrder('H', Sell, 3, 25);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,20,Buy}) == event);
+  ASSERT_EQ (0u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,20,Buy}) == event);
+  ASSERT_EQ (2u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',3,25,Sell}) == event);
+  ASSERT_EQ (UINT64_MAX, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,45,Buy}) == event);
+  ASSERT_TRUE (ex.depth('H', depth));
+  ASSERT_EQ (2, depth.orders[0].trader);
+  ASSERT_EQ (1, depth.orders[1].trader);
+
+  eng.placeOrder('H', Sell, 4, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,30,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,20,Buy}) == event);
+  ASSERT_EQ (2u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,10,Buy}) == event);
+  ASSERT_EQ (3u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',4,100,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,45,Sell}) == event);
+
+  // aggressive iceberg, the executed part is reported with the first slice
+  eng.placeOrder('H', Buy, 5, 100, Iceberg, 30);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',4,100,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',5,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,30,Buy}) == event);
+
+  eng.placeOrder('H', Sell, 6, 55);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',5,75,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',5,25,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',5,25,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',6,55,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,0,None}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+  ASSERT_EQ (0u, eng.risk.openQty('H', 1));
+  ASSERT_EQ (0u, eng.risk.openQty('H', 5));
+}
+
+TEST(MatchingEngineTest, LargeQuantities)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  ASSERT_LE (sizeof(InternalOrder), 20u);
+
+  for (uint16_t trader = 1; trader <= 5; trader++)
+  {
+    eng.placeOrder('H', Buy, trader, 1000000000);
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',trader,1000000000,Buy}) == event);
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,trader * 1000000000ull,Buy}) == event);
+  }
+
+  eng.placeOrder('H', Sell, 6, 1500000000);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,1000000000,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',6,1500000000,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,3500000000ull,Buy}) == event);
+
+  eng.placeOrder('H', Sell, 7, 4000000000u);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,1000000000,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',3,1000000000,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',4,1000000000,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',5,1000000000,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',7,4000000000u,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,500000000,Sell}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+TEST(MatchingEngineTest, DepthOfBook)
+{
+  Exchange ex;
+  Engine& eng = ex.engine;
+  BookDepth depth;
+
+  // off by default
+  eng.placeOrder('G', Sell, 1, 100);
+  ASSERT_FALSE (ex.depth('G', depth));
+  eng.marketView.enabled = true;
+  ASSERT_FALSE (ex.depth('H', depth));
+
+  eng.placeOrder('H', Sell, 1, 100);
+  eng.placeOrder('H', Sell, 2, 200);
+  eng.placeOrder('H', Sell, 3, 300);
+  eng.placeOrder('H', Buy, 4, 150);
+
+  ASSERT_TRUE (ex.depth('H', depth));
+  ASSERT_EQ (Sell, depth.side);
+  ASSERT_EQ (450u, depth.outstandingQty);
+  ASSERT_EQ (2u, depth.ordersCount);
+  ASSERT_EQ (2u, depth.size);
+  ASSERT_EQ (2, depth.orders[0].trader);
+  ASSERT_EQ (150u, depth.orders[0].qty);
+  ASSERT_EQ (0u, depth.orders[0].qtyAhead);
+  ASSERT_EQ (3, depth.orders[1].trader);
+  ASSERT_EQ (300u, depth.orders[1].qty);
+  ASSERT_EQ (150u, depth.orders[1].qtyAhead);
+
+  for (int i = 0; i < 20; i++) eng.placeOrder('H', Sell, 5, 10);
+  ASSERT_TRUE (ex.depth('H', depth));
+  ASSERT_EQ (22u, depth.ordersCount);
+  ASSERT_EQ (uint32_t(BookDepth::MAX_ORDERS), depth.size);
+
+  eng.placeOrder('H', Buy, 4, 650);
+  ASSERT_TRUE (ex.depth('H', depth));
+  ASSERT_EQ (None, depth.side);
+  ASSERT_EQ (0u, depth.size);
+}
+
+TEST(MatchingEngineTest, QueuePositionEvents)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  eng.marketView.enabled = true;
+  Event event;
+  eng.queuePositionEvents = true;
+
+  eng.placeOrder('H', Buy, 1, 100);
+  eng.placeOrder('H', Buy, 2, 50);
+  eng.placeOrder('H', Sell, 3, 200);
+
+  // qty of QueuePosition is the queue mark
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,100,Buy}) == event);
+  ASSERT_EQ (0u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{QueuePosition,'H',1,0,Buy}) == event);
+  ASSERT_EQ (0u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',2,50,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{QueuePosition,'H',2,100,Buy}) == event);
+  ASSERT_EQ (1u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,150,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,100,Buy}) == event);
+  ASSERT_EQ (0u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,50,Buy}) == event);
+  ASSERT_EQ (1u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',3,200,Sell}) == event);
+  ASSERT_EQ (2u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{QueuePosition,'H',3,150,Sell}) == event);
+  ASSERT_EQ (2u, event.orderId);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,50,Sell}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+
+  uint64_t qtyAhead = 1;
+  ASSERT_TRUE (ex.queuePosition('H', 2, 150, qtyAhead));
+  ASSERT_EQ (0u, qtyAhead);
+  ASSERT_FALSE (ex.queuePosition('G', 0, 0, qtyAhead));
+
+  // executed: not at the front, gone
+  ASSERT_FALSE (ex.queuePosition('H', 1, 100, qtyAhead));
+  eng.placeOrder('H', Buy, 4, 50);
+  ASSERT_FALSE (ex.queuePosition('H', 2, 150, qtyAhead));
+}
+
+TEST(MatchingEngineTest, QueuePositionByOrder)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  eng.marketView.enabled = true;
+  Event event;
+  uint64_t qtyAhead = 0;
+  eng.queuePositionEvents = true;
+
+  // the same trader twice, deeper than the depth snapshot
+  vector<uint64_t> ids, marks;
+  for (int i = 0; i < 10; i++) ids.push_back(eng.placeOrder('H', Sell, (5 == i) ? 1 : 2 + i, 10));
+  ids.push_back(eng.placeOrder('H', Sell, 1, 10));
+  ASSERT_EQ (Engine::NO_ORDER, eng.placeOrder('H', Sell, 1, 10, FillOrKill));
+  while (true == notif.events.pop(event))
+  {
+    if (QueuePosition != event.type) continue;
+    ASSERT_EQ (ids[marks.size()], event.orderId);
+    marks.push_back(event.qty);
+  }
+  ASSERT_EQ (ids.size(), marks.size());
+  ASSERT_TRUE (eng.queuePosition('H', ids[5], qtyAhead));
+  ASSERT_EQ (50u, qtyAhead);
+  ASSERT_TRUE (eng.queuePosition('H', ids[10], qtyAhead));
+  ASSERT_EQ (100u, qtyAhead);
+  ASSERT_FALSE (eng.queuePosition('B', ids[0], qtyAhead));
+  ASSERT_TRUE (ex.queuePosition('H', ids[10], marks[10], qtyAhead));
+  ASSERT_EQ (100u, qtyAhead);
+
+  // executions ahead move every order behind them, without any event
+  eng.placeOrder('H', Buy, 20, 15);
+  ASSERT_FALSE (eng.queuePosition('H', ids[0], qtyAhead));
+  ASSERT_TRUE (eng.queuePosition('H', ids[1], qtyAhead));
+  ASSERT_EQ (0u, qtyAhead);
+  ASSERT_TRUE (eng.queuePosition('H', ids[10], qtyAhead));
+  ASSERT_EQ (85u, qtyAhead);
+  for (size_t i = 1; i < ids.size(); i++)
+  {
+    uint64_t fromBook = 0;
+    ASSERT_TRUE (eng.queuePosition('H', ids[i], fromBook));
+    ASSERT_TRUE (ex.queuePosition('H', ids[i], marks[i], qtyAhead));
+    ASSERT_EQ (fromBook, qtyAhead) << i;
+  }
+
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,10,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',20,15,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && Tick == event.type);
+  ASSERT_FALSE (notif.events.pop(event));
+
+  // a partial fill of the front order moves only the ones behind
+  eng.placeOrder('H', Buy, 20, 2);
+  ASSERT_TRUE (ex.queuePosition('H', ids[1], marks[1], qtyAhead));
+  ASSERT_EQ (0u, qtyAhead);
+  ASSERT_TRUE (ex.queuePosition('H', ids[2], marks[2], qtyAhead));
+  ASSERT_EQ (3u, qtyAhead);
+  ASSERT_FALSE (ex.queuePosition('H', ids[0], marks[0], qtyAhead));
+}
+
+TEST(MatchingEngineTest, DepthReadWhileMatching)
+{
+  Exchange ex;
+  Engine& eng = ex.engine;
+  eng.marketView.enabled = true;
+  atomic<bool> done(false);
+
+  // readers never see a torn snapshot: the quantities always add up
+  thread reader([&](){
+    BookDepth depth;
+    while (false == done.load())
+    {
+      if (true == ex.depth('H', depth))
+      {
+        uint64_t qty = 0;
+        for (uint32_t i = 0; i < depth.size; i++)
+        {
+          ASSERT_EQ (qty, depth.orders[i].qtyAhead);
+          qty += depth.orders[i].qty;
+        }
+        if (depth.size == depth.ordersCount)
+        {
+          ASSERT_EQ (depth.outstandingQty, qty);
+        }
+      }
+    }
+  });
+
+  Event event;
+  for (int i = 0; i < 200000; i++)
+  {
+    eng.placeOrder('H', (i % 3) ? Buy : Sell, 1, 1 + i % 7);
+    while (true == ex.notif.events.pop(event));
+  }
+  done = true;
+  reader.join();
+}
+
+TEST(MatchingEngineTest, TickModes)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  // coalesced: one Tick per dirty instrument, at the flush
+  eng.tickMode = Coalesced;
+  eng.placeOrder('A', Buy, 1, 100);
+  eng.placeOrder('B', Sell, 2, 50);
+  eng.placeOrder('A', Buy, 3, 200);
+  eng.placeOrder('B', Buy, 4, 50);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'A',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'B',2,50,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'A',3,200,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'B',2,50,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'B',4,50,Buy}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+
+  eng.flushTicks();
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'A',0,300,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'B',0,0,None}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+  eng.flushTicks();
+  ASSERT_FALSE (notif.events.pop(event));
+
+  // coalesced with an interval: flushed every 2 orders
+  eng.tickInterval = 2;
+  eng.placeOrder('A', Sell, 5, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'A',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'A',5,100,Sell}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+  eng.placeOrder('A', Sell, 6, 50);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'A',6,50,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'A',0,150,Buy}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+
+  // disabled
+  eng.tickMode = NoTicks;
+  eng.placeOrder('A', Sell, 7, 150);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'A',3,200,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'A',7,150,Sell}) == event);
+  eng.flushTicks();
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+TEST(PreTradeRiskTest, Limits)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  eng.risk.setLimits(1, TraderLimits{100, 250, 0, 0});
+
+  eng.placeOrder('H', Buy, 1, 101);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',1,101,Buy}) == event);
+
+  eng.placeOrder('H', Buy, 1, 100);
+  eng.placeOrder('H', Buy, 1, 100);
+  eng.placeOrder('H', Buy, 1, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,200,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',1,100,Buy}) == event);
+  ASSERT_EQ (200u, eng.risk.openQty('H', 1));
+
+  // open quantity is per instrument
+  eng.placeOrder('G', Buy, 1, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'G',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'G',0,100,Buy}) == event);
+
+  // executions release the open quantity
+  eng.placeOrder('H', Sell, 2, 150);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec,'H',2,150,Sell}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,50,Buy}) == event);
+  ASSERT_EQ (100u, eng.risk.openQty('H', 1));
+  ASSERT_EQ (0u, eng.risk.openQty('H', 2));
+
+  eng.placeOrder('H', Buy, 1, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,100,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,150,Buy}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+TEST(PreTradeRiskTest, LargeOpenQuantity)
+{
+  Exchange ex;
+  Engine& eng = ex.engine;
+
+  // open quantity beyond 32 bits, no limits set
+  for (int i = 0; i < 6; i++)
+  {
+    ASSERT_TRUE (eng.risk.admit('H', 1, 1000000000));
+  }
+  ASSERT_EQ (6000000000u, eng.risk.openQty('H', 1));
+
+  // a limit lowered below the open quantity admits nothing
+  eng.risk.setLimits(1, TraderLimits{UINT32_MAX, 1000, 0, 0});
+  ASSERT_FALSE (eng.risk.admit('H', 1, 1));
+  eng.risk.onExec('H', 1, 6000000000u - 500);
+  ASSERT_TRUE (eng.risk.admit('H', 1, 500));
+  ASSERT_FALSE (eng.risk.admit('H', 1, 1));
+}
+
+TEST(PreTradeRiskTest, KillSwitch)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  eng.risk.kill(1);
+  eng.placeOrder('H', Buy, 1, 10);
+  eng.placeOrder('H', Buy, 2, 10);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',1,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',2,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,10,Buy}) == event);
+
+  eng.risk.resume(1);
+  eng.risk.killAll();
+  eng.placeOrder('H', Buy, 1, 10);
+  eng.placeOrder('H', Buy, 2, 10);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',1,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',2,10,Buy}) == event);
+
+  eng.risk.resumeAll();
+  eng.placeOrder('H', Buy, 1, 10);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,10,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,20,Buy}) == event);
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+TEST(PreTradeRiskTest, RateLimit)
+{
+  const uint64_t SECOND = 1000000000;
+  PreTradeRisk risk;
+  risk.setLimits(7, TraderLimits{UINT32_MAX, UINT64_MAX, 1000, 0});
+
+  // 5000 orders within one second window, then the next window
+  uint32_t admitted = 0;
+  for (int i = 0; i < 5000; i++)
+  {
+    if (true == risk.admit('H', 7, 1, 3 * SECOND + i)) admitted++;
+  }
+  ASSERT_EQ (1000u, admitted);
+  ASSERT_TRUE (risk.admit('H', 8, 1, 3 * SECOND));
+  ASSERT_TRUE (risk.admit('H', 7, 1, 4 * SECOND));
+
+  // the time the order was taken at decides the window, not the clock
+  PreTradeRisk replay;
+  replay.setLimits(7, TraderLimits{UINT32_MAX, UINT64_MAX, 2, 0});
+  ASSERT_TRUE (replay.admit('H', 7, 1, 5 * SECOND));
+  ASSERT_TRUE (replay.admit('H', 7, 1, 5 * SECOND + 1));
+  ASSERT_FALSE (replay.admit('H', 7, 1, 6 * SECOND - 1));
+  ASSERT_TRUE (replay.admit('H', 7, 1, 6 * SECOND));
+}
+
+TEST(PreTradeRiskTest, PositionLimit)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+
+  eng.risk.setLimits(1, TraderLimits{UINT32_MAX, UINT64_MAX, 0, 100});
+
+  // |position| + open quantity + qty must fit
+  eng.placeOrder('H', Buy, 1, 60);
+  eng.placeOrder('H', Buy, 1, 50);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'H',1,60,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H',0,60,Buy}) == event);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{Rejected,'H',1,50,Buy}) == event);
+
+  eng.placeOrder('H', Sell, 2, 60);
+  ASSERT_EQ (60, ex.position('H', 1).position);
+  ASSERT_EQ (0u, eng.risk.openQty('H', 1));
+
+  eng.placeOrder('H', Buy, 1, 40);
+  eng.placeOrder('H', Buy, 1, 1);
+  while (true == notif.events.pop(event) && Rejected != event.type);
+  ASSERT_TRUE ((Event{Rejected,'H',1,1,Buy}) == event);
+
+  // other instruments are not affected
+  eng.placeOrder('G', Buy, 1, 100);
+  ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced,'G',1,100,Buy}) == event);
+}
+
+TEST(PositionTableTest, FillsAndPartialFills)
+{
+  Exchange ex;
+  Engine& eng = ex.engine;
+
+  eng.placeOrder('H', Buy, 1, 100);
+  eng.placeOrder('H', Buy, 2, 50);
+  eng.placeOrder('H', Sell, 3, 120);
+  ASSERT_EQ (100, ex.position('H', 1).position);
+  ASSERT_EQ (100u, ex.position('H', 1).volume);
+  ASSERT_EQ (20, ex.position('H', 2).position);
+  ASSERT_EQ (20u, ex.position('H', 2).volume);
+  ASSERT_EQ (-120, ex.position('H', 3).position);
+  ASSERT_EQ (120u, ex.position('H', 3).volume);
+
+  // an iceberg is filled slice by slice, the cancelled rest is not a fill
+  eng.placeOrder('H', Buy, 3, 10);
+  eng.placeOrder('G', Sell, 4, 30, Iceberg, 10);
+  eng.placeOrder('G', Buy, 2, 25);
+  eng.placeOrder('H', Sell, 5, 100, ImmediateOrCancel);
+  ASSERT_EQ (-40, ex.position('H', 5).position);
+  ASSERT_EQ (40u, ex.position('H', 5).volume);
+  ASSERT_EQ (-110, ex.position('H', 3).position);
+  ASSERT_EQ (130u, ex.position('H', 3).volume);
+  ASSERT_EQ (-25, ex.position('G', 4).position);
+  ASSERT_EQ (25u, ex.position('G', 4).volume);
+
+  // all the instruments of a trader at once
+  Position all[PositionTable::INSTRUMENTS];
+  eng.risk.positions.read(2, all);
+  ASSERT_EQ (50, all['H'].position);
+  ASSERT_EQ (25, all['G'].position);
+  ASSERT_EQ (75u, all['H'].volume + all['G'].volume);
+  ASSERT_EQ (0u, all['A'].volume);
+}
+
+TEST(PositionTableTest, ReadWhileMatching)
+{
+  Exchange ex;
+  Engine& eng = ex.engine;
+  atomic<bool> done(false);
+
+  // trader 1 only buys, a torn read would show position != volume
+  thread reader([&](){
+    uint64_t last = 0;
+    while (false == done.load())
+    {
+      Position p = ex.position('H', 1);
+      ASSERT_EQ (int64_t(p.volume), p.position);
+      ASSERT_LE (last, p.volume);
+      last = p.volume;
+    }
+  });
+
+  Event event;
+  for (int i = 0; i < 200000; i++)
+  {
+    eng.placeOrder('H', Sell, 2, 1 + i % 7);
+    eng.placeOrder('H', Buy, 1, 1 + i % 5);
+    while (true == ex.notif.events.pop(event));
+  }
+  done = true;
+  reader.join();
+}
+
+TEST(PreTradeRiskTest, LimitsWhileRunning)
+{
+  {
+    Exchange ex;
+    TradingTool t1(1);
+    t1.connectTo(ex);
+    ex.start();
+
+    // only the traders that trade get slots
+    ex.engine.q.push(InputOrder{'H', 1, 10, Buy});
+    ex.stop();
+    ASSERT_EQ (1u, ex.engine.risk.positions.slots[1].load());
+    ASSERT_EQ (0u, ex.engine.risk.positions.slots[2].load());
+    ASSERT_EQ (10u, ex.engine.risk.openQty('H', 1));
+    ASSERT_EQ (0u, ex.position('H', 1).volume);
+    ASSERT_EQ (0, ex.position('H', 2).position);
+  }
+
+  Exchange running;
+  TradingTool t2(2);
+  t2.connectTo(running);
+  running.start();
+  running.engine.q.push(InputOrder{'H', 2, 10, Buy});
+  running.engine.risk.setLimits(2, TraderLimits{5, UINT64_MAX, 0, 0});
+  ASSERT_EQ (5u, running.engine.risk.getLimits(2).maxOrderQty);
+
+  // the orders sent after the change see it
+  Event event;
+  auto next = [&](){
+    while (false == t2.events.pop(event)) this_thread::yield();
+    return event;
+  };
+  next();
+  running.engine.q.push(InputOrder{'H', 2, 10, Buy});
+  ASSERT_TRUE ((Event{Rejected,'H',2,10,Buy}) == next());
+  running.stop();
+}
+
+TEST(PreTradeRiskTest, SlotsRunOut)
+{
+  PreTradeRisk risk;
+  risk.setLimits(1, TraderLimits{10, UINT64_MAX, 0, 0});
+
+  // a rejected order claims no slot
+  ASSERT_FALSE (risk.admit('H', 1, 11));
+  for (uint32_t trader = 2; trader < PreTradeRisk::SLOTS + 2; trader++) ASSERT_TRUE (risk.admit('H', trader, 1));
+  ASSERT_FALSE (risk.admit('H', 1, 1));
+  ASSERT_FALSE (risk.admit('H', PreTradeRisk::SLOTS + 2, 1));
+  ASSERT_EQ (0u, risk.openQty('H', 1));
+
+  // the traders that have one go on
+  ASSERT_TRUE (risk.admit('G', 2, 1));
+  risk.onFill('G', 2, true, 1);
+  ASSERT_EQ (1, risk.positions.read('G', 2).position);
+}
+
+// the stage has to stay well under 100 ns per order
+TEST(PreTradeRiskTest, AdmitAndExec_perf)
+{
+  const uint32_t ORDERS = 10000000;
+  PreTradeRisk risk;
+  for (uint32_t t = 0; t < 1024; t++) risk.setLimits(t, TraderLimits{1000, 100000, 1000000000, 1000000});
+
+  auto start = chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ORDERS; i++)
+  {
+    uint16_t trader = i % 1024;
+    ASSERT_TRUE (risk.admit('H', trader, 10));
+    risk.onExec('H', trader, 10);
+  }
+  double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ORDERS;
+  cout << "admit + onExec " << ns << " ns per order" << endl;
+  ASSERT_LT (ns, 100.0);
+}
+
 class MatchingEnginePerformance : public testing::TestWithParam<uint16_t> {};
 
 TEST_P(MatchingEnginePerformance, EventsBurst)
@@ -221,20 +905,588 @@ TEST_P(MatchingEnginePerformance, EventsBurst)
       ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick,'H', 0, qty, Buy}) == event);
     }
 
-    eng.placeOrder('H', Sell, 2, GetParam());
-    for (int i = 0; i < GetParam(); i++)
+    eng.placeOrder('H', Sell, 2, GetParam());
+    for (int i = 0; i < GetParam(); i++)
+    {
+      ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 1, 1, Buy}) == event);
+    }
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 2, GetParam(), Sell}) == event);
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick, 'H', 0, 0, None}) == event);
+    ASSERT_TRUE (false == notif.events.pop(event));
+  }
+}
+
+// Same bursts with one coalesced Tick per burst: (100 * 2 * GetParam()) + 2 events
+TEST_P(MatchingEnginePerformance, EventsBurstCoalescedTicks)
+{
+  Exchange ex;
+  Notifier& notif = ex.notif;
+  Engine& eng = ex.engine;
+  Event event;
+  eng.tickMode = Coalesced;
+
+  for (int n = 0; n < 100; n++)
+  {
+    for (int i = 0; i < GetParam(); i++)
+    {
+      eng.placeOrder('H', Buy, 1, 1);
+      ASSERT_TRUE (true == notif.events.pop(event) && (Event{OrderPlaced, 'H', 1, 1, Buy}) == event);
+    }
+
+    eng.placeOrder('H', Sell, 2, GetParam());
+    eng.flushTicks();
+    for (int i = 0; i < GetParam(); i++)
+    {
+      ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 1, 1, Buy}) == event);
+    }
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 2, GetParam(), Sell}) == event);
+    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick, 'H', 0, 0, None}) == event);
+    ASSERT_TRUE (false == notif.events.pop(event));
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Perfo, MatchingEnginePerformance, testing::Values(1<<1, 1<<3, 1<<5, 1<<7, 1<<9, 1<<11, 1<<13, 1<<15, (1<<16)-2),
+                        testing::PrintToStringParamName());
+
+
+TEST(EnginePolicyTest, InlineCallbackSink)
+{
+  vector<Event> events;
+  auto collect = [&](const Event& e){ events.push_back(e); };
+  BacktestEngine<Book, decltype(collect)> eng(collect);
+
+  eng.placeOrder('S', Buy, 1, 200);
+  eng.placeOrder('S', Sell, 2, 200);
+
+  ASSERT_EQ (5u, events.size());
+  ASSERT_TRUE ((Event{OrderPlaced,'S',1,200,Buy}) == events[0]);
+  ASSERT_TRUE ((Event{Tick,'S',0,200,Buy}) == events[1]);
+  ASSERT_TRUE ((Event{Exec,'S',1,200,Buy}) == events[2]);
+  ASSERT_TRUE ((Event{Exec,'S',2,200,Sell}) == events[3]);
+  ASSERT_TRUE ((Event{Tick,'S',0,0,None}) == events[4]);
+}
+
+TEST(EnginePolicyTest, CountingInstrumentation)
+{
+  Notifier notif;
+  BasicEngine<Book, NotifierSink, CountingInstrumentation, NoIngress> eng(notif);
+  Event event;
+
+  eng.placeOrder('H', Buy, 1, 10);
+  eng.placeOrder('H', Sell, 2, 0);
+  eng.placeOrder('H', Sell, 2, 10);
+
+  ASSERT_EQ (2u, eng.instrumentation.orders);
+  ASSERT_EQ (5u, eng.instrumentation.events);
+  for (int i = 0; i < 5; i++) ASSERT_TRUE (notif.events.pop(event));
+  ASSERT_FALSE (notif.events.pop(event));
+}
+
+// wall clock ms of one run
+template <typename F>
+static double elapsedMs(F run)
+{
+  auto start = chrono::steady_clock::now();
+  run();
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Same order flow through the production (events ring) and the inlined
+// callback sinks, the engines differ in the sink only: inlining must pay off.
+TEST(EnginePolicyTest, InlineSinkFasterThanNotifierSink_perf)
+{
+  const int ORDERS = 1000000;
+  Notifier notif;
+  BasicEngine<Book, NotifierSink, NoInstrumentation, NoIngress> ring(notif);
+  uint64_t ringEvents = 0, inlineEvents = 0;
+  auto count = [&](const Event&){ inlineEvents++; };
+  BacktestEngine<Book, decltype(count)> inlined(count);
+
+  double ringMs = elapsedMs([&](){
+    Event event;
+    for (int i = 0; i < ORDERS; i++)
+    {
+      ring.placeOrder('H', (i % 2) ? Sell : Buy, 1, 10);
+      while (true == notif.events.pop(event)) ringEvents++;
+    }
+  });
+  double inlineMs = elapsedMs([&](){
+    for (int i = 0; i < ORDERS; i++) inlined.placeOrder('H', (i % 2) ? Sell : Buy, 1, 10);
+  });
+  cout << "notifier sink " << ringMs << " ms, inline sink " << inlineMs << " ms" << endl;
+
+  ASSERT_EQ (uint64_t(ORDERS) / 2 * 5, ringEvents);
+  ASSERT_EQ (ringEvents, inlineEvents);
+  ASSERT_LT (inlineMs, ringMs);
+}
+
+TEST(SweepKernelTest, KernelsAgree)
+{
+  mt19937_64 rng(7);
+  vector<pair<Isa, SweepKernel>> kernels = {{Generic, sweepScalar}, {Sse42, sweepSse42}, {Avx2, sweepAvx2}, {Avx512, sweepAvx512}};
+
+  for (int n = 0; n < 100000; n++)
+  {
+    vector<uint32_t> qty(rng() % 80);
+    for (auto& q : qty) q = (0 == rng() % 3) ? static_cast<uint32_t>(rng()) : rng() % 10;
+    uint64_t available = (n % 2) ? rng() % 100 : rng() % (1ull << 37);
+
+    uint64_t expected = 0, consumed = 0;
+    size_t count = sweepScalar(qty.data(), qty.size(), available, expected);
+    ASSERT_EQ (count, sweepOrders(qty.data(), qty.size(), available, consumed));
+    ASSERT_EQ (expected, consumed);
+    for (auto& kernel : kernels)
+    {
+      if (false == cpuSupports(kernel.first)) continue;
+      ASSERT_EQ (count, kernel.second(qty.data(), qty.size(), available, consumed)) << isaName(kernel.first);
+      ASSERT_EQ (expected, consumed) << isaName(kernel.first);
+    }
+  }
+}
+
+TEST(ChecksumTest, Crc32c)
+{
+  const char* check = "123456789";
+  ASSERT_EQ (0xE3069283u, crc32cGeneric(0, check, 9));
+  ASSERT_EQ (0xE3069283u, crc32c(0, check, 9));
+  ASSERT_EQ (0xE3069283u, crc32cGeneric(crc32cGeneric(0, check, 4), check + 4, 5));
+
+  mt19937_64 rng(3);
+  vector<uint8_t> data(1000);
+  for (auto& d : data) d = static_cast<uint8_t>(rng());
+  if (false == cpuSupports(Sse42)) return;
+  for (size_t len = 0; len < data.size(); len += 7)
+  {
+    ASSERT_EQ (crc32cGeneric(0, data.data(), len), crc32cSse42(0, data.data(), len));
+  }
+}
+
+// Same kernels built for every instruction set, each one has to beat the
+// generic build on the same work.
+class CpuDispatchPerformance : public testing::TestWithParam<Isa>
+{
+public:
+  virtual void SetUp()
+  {
+    if (false == cpuSupports(GetParam())) GTEST_SKIP() << "cpu without " << isaName(GetParam());
+    ASSERT_EQ (GetParam(), dispatchKernels(GetParam()));
+  }
+
+  virtual void TearDown()
+  {
+    dispatchKernels(cpuIsa());
+  }
+
+  template <typename F>
+  void fasterThanGeneric(F run)
+  {
+    double dispatched = elapsedMs(run);
+    if (Generic == GetParam()) return;
+    dispatchKernels(Generic);
+    double generic = elapsedMs(run);
+    dispatchKernels(GetParam());
+    cout << isaName(GetParam()) << " " << dispatched << " ms, generic " << generic << " ms" << endl;
+    ASSERT_LT (dispatched, generic);
+  }
+};
+
+// 64M resting orders of qty 1..4 swept 4096 orders at a time
+TEST_P(CpuDispatchPerformance, Sweep)
+{
+  vector<uint32_t> qty(1 << 16);
+  for (size_t i = 0; i < qty.size(); i++) qty[i] = 1 + i % 4;
+
+  fasterThanGeneric([&](){
+    uint64_t orders = 0;
+    for (int n = 0; n < 1024; n++)
+    {
+      for (size_t at = 0; at < qty.size(); )
+      {
+        uint64_t consumed = 0;
+        size_t count = sweepOrders(qty.data() + at, qty.size() - at, 4096 * 5 / 2, consumed);
+        ASSERT_EQ (4096u, count);
+        at += count;
+        orders += count;
+      }
+    }
+    ASSERT_EQ (uint64_t(1) << 26, orders);
+  });
+}
+
+// 64MB checksummed in 4kB records
+TEST_P(CpuDispatchPerformance, Crc32c)
+{
+  vector<uint8_t> record(4096);
+  for (size_t i = 0; i < record.size(); i++) record[i] = static_cast<uint8_t>(i * 31);
+
+  fasterThanGeneric([&](){
+    uint32_t crc = 0;
+    for (int n = 0; n < 16384; n++) crc = crc32c(crc, record.data(), record.size());
+    ASSERT_NE (0u, crc);
+  });
+}
+
+// 64M rows of a byte column and a 16 bit column filtered
+TEST_P(CpuDispatchPerformance, Filter)
+{
+  vector<uint8_t> instrument(1 << 20);
+  vector<uint16_t> trader(1 << 20);
+  for (size_t i = 0; i < instrument.size(); i++)
+  {
+    instrument[i] = 'A' + i % 4;
+    trader[i] = i % 1000;
+  }
+
+  vector<uint64_t> mask(instrument.size() / 64);
+  fasterThanGeneric([&](){
+    uint64_t selected = 0;
+    for (int n = 0; n < 64; n++)
+    {
+      fill(mask.begin(), mask.end(), ~uint64_t(0));
+      filterU8(instrument.data(), instrument.size(), 'B', mask.data());
+      filterU16(trader.data(), trader.size(), 5, mask.data());
+      for (uint64_t w : mask) selected += __builtin_popcountll(w);
+    }
+    ASSERT_EQ (64u * 1049u, selected);
+  });
+}
+
+INSTANTIATE_TEST_SUITE_P(Isa, CpuDispatchPerformance, testing::Values(Generic, Sse42, Avx2, Avx512),
+                        [](const testing::TestParamInfo<Isa>& info){ return string(isaName(info.param)); });
+
+TEST(ScanKernelTest, KernelsAgree)
+{
+  mt19937_64 rng(11);
+  vector<pair<Isa, FilterU8Kernel>> u8 = {{Generic, filterU8Scalar}, {Sse42, filterU8Sse42}, {Avx2, filterU8Avx2}};
+  vector<pair<Isa, FilterU16Kernel>> u16 = {{Generic, filterU16Scalar}, {Sse42, filterU16Sse42}, {Avx2, filterU16Avx2}};
+
+  for (int n = 0; n < 2000; n++)
+  {
+    size_t rows = rng() % 300;
+    vector<uint8_t> a(rows);
+    vector<uint16_t> b(rows);
+    for (auto& x : a) x = (0 == rng() % 2) ? 'A' + rng() % 3 : rng();
+    for (auto& x : b) x = (0 == rng() % 2) ? 1000 + rng() % 3 : rng();
+    vector<uint64_t> start((rows + 63) / 64);
+    for (auto& w : start) w = rng();
+
+    vector<uint64_t> expected = start;
+    filterU8Scalar(a.data(), rows, 'A', expected.data());
+    filterU16Scalar(b.data(), rows, 1000, expected.data());
+    for (size_t k = 0; k < u8.size(); k++)
+    {
+      if (false == cpuSupports(u8[k].first)) continue;
+      vector<uint64_t> mask = start;
+      u8[k].second(a.data(), rows, 'A', mask.data());
+      u16[k].second(b.data(), rows, 1000, mask.data());
+      ASSERT_TRUE (expected == mask) << isaName(u8[k].first);
+    }
+  }
+}
+
+// Oracle for the differential tests, written apart from placeOrder: the
+// resting slices of a book in a plain list in arrival order, the totals
+// kept with every slice added, filled and removed (count() adds them up
+// again from the list, the tests compare both every 1000 orders), the
+// traded quantity decided up front and handed out to the oldest slice one
+// at a time.
+struct NaiveMatcher
+{
+  struct Slice
+  {
+    uint64_t id;        // arrival number in the book
+    uint16_t trader;
+    uint64_t reported;  // qty of its Exec event
+    uint64_t shown;
+    uint64_t filled;    // of the shown quantity
+    uint64_t display;
+    uint64_t reserve;   // iceberg hidden quantity
+  };
+
+  struct Book
+  {
+    Side side = None;
+    deque<Slice> slices;
+    uint64_t arrivals = 0, dequeued = 0;
+    uint64_t outstanding = 0, opened = 0, hidden = 0;
+  };
+
+  struct Totals
+  {
+    uint64_t outstanding = 0, opened = 0, hidden = 0;
+  };
+
+  static Totals count(const Book& book)
+  {
+    Totals t;
+    for (auto& s : book.slices)
+    {
+      t.outstanding += s.shown - s.filled;
+      t.opened += s.reported;
+      t.hidden += s.reserve;
+    }
+    return t;
+  }
+
+  void placeOrder(char instrument, Side side, uint16_t trader, uint32_t qty, OrderType type, uint32_t displayQty, vector<Event>& out)
+  {
+    if (0 == qty || None == side) return;
+    if (Iceberg == type && (0 == displayQty || displayQty >= qty)) type = Regular;
+
+    Book& book = books[instrument];
+    bool crossing = (false == book.slices.empty() && side != book.side);
+    uint64_t available = crossing ? book.outstanding + book.hidden : 0;
+
+    if ((FillOrKill == type && available < qty) || (ImmediateOrCancel == type && false == crossing))
+    {
+      out.push_back({Cancelled, instrument, trader, qty, side});
+      return;
+    }
+
+    uint64_t traded = min<uint64_t>(qty, available);
+    positions[make_pair(instrument, trader)] += (Buy == side) ? int64_t(traded) : -int64_t(traded);
+    for (uint64_t left = traded; 0 != left; )
+    {
+      Slice& oldest = book.slices.front();
+      uint64_t take = min(left, oldest.shown - oldest.filled);
+      oldest.filled += take;
+      left -= take;
+      book.dequeued += take;
+      book.outstanding -= take;
+      positions[make_pair(instrument, oldest.trader)] += (Buy == book.side) ? int64_t(take) : -int64_t(take);
+      if (oldest.filled != oldest.shown) continue;
+
+      Slice done = oldest;
+      book.slices.pop_front();
+      book.opened -= done.reported;
+      book.hidden -= done.reserve;
+      out.push_back(Event{Exec, instrument, done.trader, done.reported, book.side, done.id});
+      if (0 != done.reserve)
+      {
+        uint64_t slice = min(done.display, done.reserve);
+        book.slices.push_back({book.arrivals++, done.trader, slice, slice, 0, done.display, done.reserve - slice});
+        book.outstanding += slice;
+        book.opened += slice;
+        book.hidden += done.reserve - slice;
+        out.push_back(Event{OrderPlaced, instrument, done.trader, slice, book.side, book.slices.back().id});
+      }
+    }
+
+    uint64_t rest = qty - traded;
+    if (0 == rest)
+    {
+      out.push_back({Exec, instrument, trader, qty, side});
+    }
+    else if (ImmediateOrCancel == type)
+    {
+      if (0 != traded) out.push_back({Exec, instrument, trader, traded, side});
+      out.push_back({Cancelled, instrument, trader, rest, side});
+    }
+    else
+    {
+      uint64_t shown = (Iceberg == type) ? min<uint64_t>(displayQty, rest) : rest;
+      book.side = side;
+      book.slices.push_back({book.arrivals++, trader, traded + shown, shown, 0, displayQty, rest - shown});
+      book.outstanding += shown;
+      book.opened += traded + shown;
+      book.hidden += rest - shown;
+      out.push_back(Event{OrderPlaced, instrument, trader, qty, side, book.slices.back().id});
+    }
+
+    if (true == book.slices.empty()) out.push_back({Tick, instrument, 0, 0, None});
+    else out.push_back({Tick, instrument, 0, book.outstanding, book.side});
+  }
+
+  int64_t position(char instrument, uint16_t trader)
+  {
+    return positions[make_pair(instrument, trader)];
+  }
+
+  map<char, Book> books;
+  map<pair<char, uint16_t>, int64_t> positions;
+};
+
+// Seeded order flow: phases with a changing buy ratio build deep books and
+// sweep them, mostly small orders with a few large ones, all order types.
+struct FuzzOrderStream
+{
+  FuzzOrderStream(uint64_t seed) : rng(seed), buyRatio(0.5), n(0) {}
+
+  InputOrder next()
+  {
+    if (0 == n++ % 1000) buyRatio = 0.2 + 0.6 * unit(rng);
+
+    uint32_t qty = 0;
+    uint32_t size = rng() % 100;
+    if (size < 80) qty = 1 + rng() % 10;
+    else if (size < 95) qty = 1 + rng() % 100;
+    else if (size < 99) qty = 1 + rng() % 5000;
+    else qty = rng() % 3;  // 0 is ignored by the engine
+
+    InputOrder o{static_cast<char>('A' + rng() % 3), static_cast<uint16_t>(1 + rng() % 50), qty, (unit(rng) < buyRatio) ? Buy : Sell};
+    uint32_t type = rng() % 10;
+    if (7 == type) o.type = ImmediateOrCancel;
+    else if (8 == type) o.type = FillOrKill;
+    else if (9 == type)
+    {
+      o.type = Iceberg;
+      o.displayQty = rng() % (qty + 1);
+    }
+    return o;
+  }
+
+  mt19937_64 rng;
+  uniform_real_distribution<double> unit;
+  double buyRatio;
+  uint64_t n;
+};
+
+// Every sweep kernel against the oracle: the same events (and order ids)
+// for every order and the same book counters, the whole books compared
+// every 1000 orders.
+class MatchingEngineFuzzTest : public CpuDispatchPerformance {};
+
+static void expectEvents(vector<Event>& expected, vector<Event>& events, uint64_t seed, int i)
+{
+  ASSERT_EQ (expected.size(), events.size()) << "seed " << seed << " order " << i;
+  for (size_t k = 0; k < events.size(); k++)
+  {
+    ASSERT_TRUE (expected[k] == events[k]) << "seed " << seed << " order " << i << " event " << k;
+    ASSERT_EQ (expected[k].orderId, events[k].orderId) << "seed " << seed << " order " << i << " event " << k;
+  }
+}
+
+TEST_P(MatchingEngineFuzzTest, DifferentialAgainstOracle)
+{
+  const int SEEDS = 4, ORDERS = 250000;
+
+  for (uint64_t seed = 1; seed <= SEEDS; seed++)
+  {
+    vector<Event> events, expected;
+    auto collect = [&](const Event& e){ events.push_back(e); };
+    BacktestEngine<Book, decltype(collect)> eng(collect);
+    NaiveMatcher oracle;
+    FuzzOrderStream stream(seed);
+
+    for (int i = 0; i < ORDERS; i++)
+    {
+      InputOrder o = stream.next();
+      events.clear();
+      expected.clear();
+      eng.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty);
+      oracle.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty, expected);
+      expectEvents(expected, events, seed, i);
+      if (true == HasFatalFailure()) return;
+
+      if (0 == o.qty || None == o.side) continue;
+      const Book& book = eng.books[o.instrument];
+      const NaiveMatcher::Book& ref = oracle.books[o.instrument];
+      ASSERT_EQ (ref.outstanding, book.outstandingQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.opened, book.openedOrdersQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.hidden, book.hiddenQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.dequeued, book.dequeuedQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.slices.size(), book.orders.size()) << "seed " << seed << " order " << i;
+
+      if (0 != i % 1000) continue;
+      for (auto& entry : oracle.books)
+      {
+        NaiveMatcher::Totals totals = NaiveMatcher::count(entry.second);
+        ASSERT_EQ (totals.outstanding, entry.second.outstanding) << "seed " << seed << " order " << i;
+        ASSERT_EQ (totals.opened, entry.second.opened) << "seed " << seed << " order " << i;
+        ASSERT_EQ (totals.hidden, entry.second.hidden) << "seed " << seed << " order " << i;
+        const Book& b = eng.books[entry.first];
+        for (size_t k = 0; k < entry.second.slices.size(); k++)
+        {
+          const NaiveMatcher::Slice& r = entry.second.slices[k];
+          ASSERT_EQ (r.id, b.orders.id(k));
+          ASSERT_EQ (r.trader, b.orders.order(k).trader);
+          ASSERT_EQ (r.shown - r.filled, b.orders.remainingQty(k));
+          ASSERT_EQ (r.reported, b.orders.order(k).qty);
+          ASSERT_EQ (r.reserve, b.orders.order(k).reserve);
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Isa, MatchingEngineFuzzTest, testing::Values(Generic, Sse42, Avx2, Avx512),
+                        [](const testing::TestParamInfo<Isa>& info){ return string(isaName(info.param)); });
+
+// The Engine of the Exchange (risk stage, depth snapshots, notifier ring)
+// against the oracle: the events, the published depth after every order and
+// the positions every 1000 orders.
+TEST(MatchingEngineFuzzTest, ExchangeEngineAgainstOracle)
+{
+  const int SEEDS = 2, ORDERS = 100000;
+
+  for (uint64_t seed = 1; seed <= SEEDS; seed++)
+  {
+    unique_ptr<Exchange> ex(new Exchange);
+    ex->engine.marketView.enabled = true;
+    NaiveMatcher oracle;
+    FuzzOrderStream stream(seed);
+    vector<Event> events, expected;
+    Event event;
+
+    for (int i = 0; i < ORDERS; i++)
     {
-      ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 1, 1, Buy}) == event);
+      InputOrder o = stream.next();
+      events.clear();
+      expected.clear();
+      ex->engine.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty);
+      while (true == ex->notif.events.pop(event)) events.push_back(event);
+      oracle.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty, expected);
+      expectEvents(expected, events, seed, i);
+      if (true == HasFatalFailure()) return;
+
+      if (0 == o.qty || None == o.side) continue;
+      const NaiveMatcher::Book& ref = oracle.books[o.instrument];
+      // nothing published before the first order that got to the book
+      BookDepth depth{None, 0, 0, 0, 0, 0, {}};
+      ex->depth(o.instrument, depth);
+      ASSERT_EQ (ref.slices.empty() ? None : ref.side, depth.side) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.outstanding, depth.outstandingQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.dequeued, depth.dequeuedQty) << "seed " << seed << " order " << i;
+      ASSERT_EQ (ref.slices.size(), depth.ordersCount) << "seed " << seed << " order " << i;
+      ASSERT_EQ (min<size_t>(ref.slices.size(), BookDepth::MAX_ORDERS), depth.size);
+      uint64_t qtyAhead = 0;
+      for (uint32_t k = 0; k < depth.size; k++)
+      {
+        const NaiveMatcher::Slice& r = ref.slices[k];
+        ASSERT_EQ (r.trader, depth.orders[k].trader);
+        ASSERT_EQ (r.shown - r.filled, depth.orders[k].qty);
+        ASSERT_EQ (qtyAhead, depth.orders[k].qtyAhead);
+        qtyAhead += r.shown - r.filled;
+      }
+
+      if (0 != i % 1000) continue;
+      for (char instrument : {'A', 'B', 'C'})
+      {
+        for (uint16_t trader = 1; trader <= 50; trader++)
+        {
+          ASSERT_EQ (oracle.position(instrument, trader), ex->position(instrument, trader).position) << "seed " << seed << " order " << i;
+        }
+      }
     }
-    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Exec, 'H', 2, GetParam(), Sell}) == event);
-    ASSERT_TRUE (true == notif.events.pop(event) && (Event{Tick, 'H', 0, 0, None}) == event);
-    ASSERT_TRUE (false == notif.events.pop(event));
   }
 }
 
-INSTANTIATE_TEST_SUITE_P(Perfo, MatchingEnginePerformance, testing::Values(1<<1, 1<<3, 1<<5, 1<<7, 1<<9, 1<<11, 1<<13, 1<<15, (1<<16)-2),
-                        testing::PrintToStringParamName());
+// large aggressive orders sweeping many small resting orders
+TEST(MatchingEnginePerformance, Sweep_perf)
+{
+  uint64_t events = 0;
+  auto count = [&](const Event&){ events++; };
+  BacktestEngine<Book, decltype(count)> eng(count);
+
+  for (int n = 0; n < 200; n++)
+  {
+    for (int i = 0; i < 10000; i++) eng.placeOrder('H', Buy, 1, 1 + i % 4);
+    eng.placeOrder('H', Sell, 2, 25000);
+  }
 
+  ASSERT_EQ (200u * (10000 * 2 + 10001 + 1), events);
+  ASSERT_TRUE (eng.books['H'].orders.empty());
+}
 
 TEST(MultiProducerMultiConsumerQueueTest, OneThread_perf)
 {
@@ -323,6 +1575,46 @@ TEST(SingleProducerSingleConsumerQueueTest, TwoThreads_perf)
   t1.join();
 }
 
+TEST(SingleProducerSingleConsumerQueueTest, BulkPop)
+{
+  SingleProducerSingleConsumerQueue<uint32_t,8> q;
+  uint32_t out[8];
+
+  ASSERT_EQ (0u, q.pop(out, 8));
+  for (uint32_t i = 0; i < 6; i++) ASSERT_TRUE (q.push(i));
+  ASSERT_EQ (4u, q.pop(out, 4));
+  for (uint32_t i = 6; i < 12; i++) ASSERT_TRUE (q.push(i));
+  ASSERT_FALSE (q.push(12));
+
+  // wraps around the end of the ring
+  ASSERT_EQ (8u, q.pop(out, 10));
+  for (uint32_t i = 0; i < 8; i++) ASSERT_EQ (i + 4, out[i]);
+  ASSERT_EQ (0u, q.pop(out, 8));
+}
+
+TEST(LatencyHistogramTest, PercentilesWithinPrecision)
+{
+  const uint64_t values[] = {0, 63, 64, 65, 127, 128, 1000, 100000, 150000000, 1ull << 40};
+  for (uint64_t v : values)
+  {
+    LatencyHistogram h;
+    h.record(v);
+    uint64_t p = h.percentile(50);
+    ASSERT_LE (p, v);
+    ASSERT_LE (v - p, v / LatencyHistogram::SUB);
+  }
+
+  LatencyHistogram h;
+  for (uint64_t v = 1; v <= 1000000; v++) h.record(v);
+  for (double p : {50.0, 90.0, 99.0, 99.9})
+  {
+    uint64_t expected = static_cast<uint64_t>(p * 10000);
+    uint64_t got = h.percentile(p);
+    ASSERT_LE (expected > got ? expected - got : got - expected, expected / LatencyHistogram::SUB);
+  }
+  ASSERT_EQ (1000000u, h.percentile(100));
+}
+
 class IntegrationTest : public ::testing::Test
 {
 public:
@@ -534,6 +1826,899 @@ TEST_F(IntegrationTest, ThreeTraderConnectedToExchange_OrderSlicing_15250_orders
 }
 
 
+// Every trader sends `rounds` orders of qty 1, the next one after the previous
+// is executed. Odd traders sell, even traders buy.
+struct TraderPopulation
+{
+  TraderPopulation(Exchange& ex, uint16_t count, uint32_t rounds) : done(0), total(count)
+  {
+    for (uint16_t id = 1; id <= count; id++)
+    {
+      TradingTool* trader = new TradingTool(id);
+      trader->init = [](TradingTool* me){
+        me->q->push(InputOrder{'H', me->id, 1, (me->id % 2) ? Sell : Buy});
+      };
+      trader->algo = [this, rounds](TradingTool* me, Event e){
+        if (Exec != e.type) return;
+        if (++executed[me->id] < rounds)
+        {
+          me->q->push(InputOrder{'H', me->id, 1, (me->id % 2) ? Sell : Buy});
+        }
+        else
+        {
+          done++;
+        }
+      };
+      trader->connectTo(ex);
+      traders.emplace_back(trader);
+    }
+    executed.assign(count + 1, 0);
+  }
+
+  bool wait(chrono::milliseconds timeout)
+  {
+    auto deadline = chrono::steady_clock::now() + timeout;
+    while (done.load() != total && chrono::steady_clock::now() < deadline)
+    {
+      this_thread::sleep_for(1ms);
+    }
+    return done.load() == total;
+  }
+
+  vector<unique_ptr<TradingTool>> traders;
+  vector<uint32_t> executed;
+  atomic<uint32_t> done;
+  uint32_t total;
+};
+
+TEST(ExchangeShutdownTest, StopDrainsQueuedOrdersAndEvents)
+{
+  // traders are not started, their rings keep everything that was delivered
+  Exchange ex;
+  TradingTool buyer(1), seller(2);
+  buyer.connectTo(ex);
+  seller.connectTo(ex);
+  ex.start();
+
+  for (int i = 0; i < 5000; i++) ex.engine.q.push(InputOrder{'H', 1, 1, Buy});
+  for (int i = 0; i < 5000; i++) ex.engine.q.push(InputOrder{'H', 2, 1, Sell});
+
+  ex.stop();
+
+  auto count = [](TradingTool& t, EventType type){
+    size_t n = 0;
+    Event e;
+    while (true == t.events.pop(e)) n += (type == e.type);
+    return n;
+  };
+  ASSERT_EQ (5000u, count(buyer, Exec));
+  ASSERT_EQ (5000u, count(seller, Exec));
+  ASSERT_FALSE (ex.engine.q.push(InputOrder{'H', 1, 1, Buy}));
+}
+
+TEST(ExchangeShutdownTest, StopDiscardingUnreadRing)
+{
+  // more events than the ring of the client holds, nobody reads it
+  unique_ptr<TradingTool> trader(new TradingTool(1));
+  Exchange ex;
+  trader->connectTo(ex);
+  ex.start();
+
+  for (int i = 0; i < 40000; i++) ex.engine.q.push(InputOrder{'H', 1, 1, Buy});
+  for (int i = 0; i < 40000; i++) ex.engine.q.push(InputOrder{'H', 1, 1, Sell});
+
+  ex.stopDiscarding(trader->events);
+  Event e;
+  ASSERT_FALSE (trader->events.pop(e));
+  ASSERT_TRUE (ex.engine.books['H'].orders.empty());
+}
+
+// clients 1..n on the heap, every one holds a 64k events ring
+static vector<unique_ptr<TradingTool>> connectClients(Exchange& ex, uint16_t n)
+{
+  vector<unique_ptr<TradingTool>> clients;
+  for (uint16_t id = 1; id <= n; id++)
+  {
+    clients.emplace_back(new TradingTool(id));
+    clients.back()->connectTo(ex);
+  }
+  return clients;
+}
+
+TEST(CaptureTest, RoundTripAndRoll)
+{
+  char dir[] = "/tmp/exengine-capture-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+
+  vector<InputOrder> sent;
+  {
+    Exchange ex;
+    auto clients = connectClients(ex, 3);
+    unique_ptr<Capture> capture(new Capture(dir, 1000));
+    capture->attach(ex);
+    capture->start();
+    ex.start();
+
+    mt19937_64 rng(3);
+    for (int i = 0; i < 2500; i++)
+    {
+      InputOrder o{(rng() % 2) ? 'A' : 'B', static_cast<uint16_t>(1 + rng() % 3), static_cast<uint32_t>(1 + rng() % 50), (rng() % 2) ? Buy : Sell};
+      if (0 == rng() % 5) o.type = ImmediateOrCancel;
+      sent.push_back(o);
+      ex.engine.q.push(o);
+    }
+
+    ex.stop();
+    capture->stop();
+    ASSERT_EQ (2500u, capture->inputsSeq);
+  }
+
+  // inputs in matching order, 1000 rows per segment
+  vector<string> inputs = captureSegments(dir, "inputs");
+  ASSERT_EQ (3u, inputs.size());
+  vector<InputOrder> captured;
+  SegmentReader reader;
+  for (auto& path : inputs)
+  {
+    ASSERT_TRUE (reader.open(path));
+    ASSERT_EQ (captured.size() + 1, reader.header->firstSeq);
+    for (size_t r = 0; r < reader.rows(); r++)
+    {
+      captured.push_back(reader.input(r));
+      ASSERT_EQ (captured.size(), reader.data<uint64_t>(SeqColumn)[r]);
+    }
+  }
+  ASSERT_EQ (sent.size(), captured.size());
+  for (size_t i = 0; i < sent.size(); i++) ASSERT_TRUE (sent[i] == captured[i]) << i;
+
+  // replaying the inputs gives the captured events
+  vector<Event> expected;
+  auto collect = [&](const Event& e){ expected.push_back(e); };
+  BacktestEngine<Book, decltype(collect)> replay(collect);
+  for (auto& o : captured) replay.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty);
+
+  vector<Event> events;
+  size_t selected = 0, selectedExpected = 0;
+  for (auto& path : captureSegments(dir, "events"))
+  {
+    ASSERT_TRUE (reader.open(path));
+    for (size_t r = 0; r < reader.rows(); r++) events.push_back(reader.event(r));
+
+    vector<uint64_t> rows;
+    CaptureFilter filter;
+    filter.instrument = 'A';
+    filter.trader = 2;
+    filter.type = Exec;
+    selected += reader.select(filter, rows);
+    for (uint64_t r : rows) ASSERT_TRUE ((Event{Exec, 'A', 2, reader.event(r).qty, reader.event(r).side}) == reader.event(r));
+  }
+  ASSERT_EQ (expected.size(), events.size());
+  for (size_t i = 0; i < expected.size(); i++) ASSERT_TRUE (expected[i] == events[i] && expected[i].orderId == events[i].orderId) << i;
+  for (auto& e : expected) selectedExpected += (Exec == e.type && 'A' == e.instrument && 2 == e.trader);
+  ASSERT_EQ (selectedExpected, selected);
+  ASSERT_NE (0u, selected);
+
+  reader.close();
+  for (auto& path : captureSegments(dir, "events")) unlink(path.c_str());
+  for (auto& path : inputs) unlink(path.c_str());
+  rmdir(dir);
+}
+
+TEST(CaptureTest, DroppedEventsLeaveAGapInSeq)
+{
+  // nobody drains the capture ring: the Notifier drops what does not fit
+  Notifier notif;
+  unique_ptr<SingleProducerSingleConsumerQueue<SequencedEvent>> ring(new SingleProducerSingleConsumerQueue<SequencedEvent>());
+  atomic<uint64_t> dropped(0);
+  notif.capture = ring.get();
+  notif.captureDropped = &dropped;
+  notif.start();
+  const uint64_t SIZE = 1 << 16;
+  for (uint64_t i = 0; i < SIZE + 100; i++) notif.events.forcePush(Event{Tick, 'A', 0, i, None});
+  while (100 != dropped.load()) this_thread::yield();
+
+  vector<SequencedEvent> captured(SIZE);
+  ASSERT_EQ (SIZE, ring->pop(captured.data(), SIZE));
+  notif.events.forcePush(Event{Tick, 'A', 0, 0, None});
+  notif.stop();
+
+  ASSERT_EQ (100u, dropped.load());
+  for (uint64_t i = 0; i < SIZE; i++) ASSERT_EQ (i + 1, captured[i].seq);
+  SequencedEvent next;
+  ASSERT_TRUE (ring->pop(next));
+  ASSERT_EQ (SIZE + 101, next.seq);
+}
+
+TEST(CaptureTest, WriteErrorsAndDamagedSegments)
+{
+  // nowhere to write: the capture gives up, the exchange keeps going
+  {
+    Exchange ex;
+    TradingTool t1(1);
+    t1.connectTo(ex);
+    unique_ptr<Capture> capture(new Capture("/nonexistent/exengine-capture", 100));
+    capture->attach(ex);
+    capture->start();
+    ex.start();
+    for (int i = 0; i < 1000; i++) ex.engine.q.push(InputOrder{'A', 1, 1, Buy});
+    ex.stop();
+    capture->stop();
+    ASSERT_TRUE (capture->failed);
+    ASSERT_NE (string::npos, capture->error.find("/nonexistent/exengine-capture"));
+    ASSERT_EQ (0u, capture->inputsSeq + capture->eventsSeq);
+    ASSERT_LE (1000u, capture->dropped);
+  }
+
+  // a capture thread that does not keep up: the engine drops and counts
+  // instead of waiting (rejected orders, no events to deliver)
+  {
+    Exchange ex;
+    unique_ptr<Capture> capture(new Capture("/nonexistent/exengine-capture", 100));
+    capture->attach(ex);
+    ex.start();
+    for (int i = 0; i < 70000; i++) ex.engine.q.push(InputOrder{'A', 1, 0, Buy});
+    ex.stop();
+    ASSERT_EQ (70000u, ex.engine.inputSeq);
+    ASSERT_NE (0u, capture->dropped);
+    ASSERT_EQ (70000u, capture->dropped + capture->inputs.pop(vector<SequencedInput>(70000).data(), 70000));
+  }
+
+  char dir[] = "/tmp/exengine-capture-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  {
+    SegmentWriter writer(dir, "inputs", InputsCapture, 100);
+    for (uint64_t seq = 1; seq <= 60; seq++) writer.append(seq, 0, Regular, 'A', 1, seq, Buy, 0, UINT64_MAX);
+  }
+  vector<string> segments = captureSegments(dir, "inputs");
+  ASSERT_EQ (1u, segments.size());
+  SegmentReader reader;
+  ASSERT_TRUE (reader.open(segments[0]));
+  ASSERT_EQ (60u, reader.rows());
+  reader.close();
+
+  // a column past the end of the file
+  int fd = open(segments[0].c_str(), O_RDWR);
+  ASSERT_LE (0, fd);
+  uint64_t offset = 1 << 30;
+  ASSERT_EQ (ssize_t(sizeof(offset)), pwrite(fd, &offset, sizeof(offset), offsetof(SegmentHeader, offsets) + QtyColumn * sizeof(offset)));
+  ASSERT_FALSE (reader.open(segments[0]));
+
+  // truncated
+  ASSERT_EQ (0, ftruncate(fd, SegmentHeader::SIZE + 64));
+  close(fd);
+  ASSERT_FALSE (reader.open(segments[0]));
+
+  unlink(segments[0].c_str());
+
+  // a segment that cannot be sized is not left behind
+  {
+    SegmentWriter writer(dir, "inputs", InputsCapture, uint64_t(1) << 50);
+    ASSERT_THROW (writer.append(1, 0, Regular, 'A', 1, 1, Buy, 0, UINT64_MAX), system_error);
+  }
+  ASSERT_TRUE (captureSegments(dir, "inputs").empty());
+  rmdir(dir);
+}
+
+static vector<InputOrder> replicationFlow(int count)
+{
+  mt19937_64 rng(5);
+  vector<InputOrder> orders;
+  for (int i = 0; i < count; i++)
+  {
+    InputOrder o{(rng() % 2) ? 'A' : 'B', static_cast<uint16_t>(1 + rng() % 3), static_cast<uint32_t>(1 + rng() % 20), (rng() % 2) ? Buy : Sell};
+    if (0 == rng() % 4) o.type = ImmediateOrCancel;
+    if (0 == rng() % 8)
+    {
+      o.type = Iceberg;
+      o.displayQty = 1 + rng() % 5;
+    }
+    orders.push_back(o);
+  }
+  return orders;
+}
+
+// Standby process: follows the primary, catches up the orders sent before
+// it was listening, takes over when the primary is gone (a byte on `control`).
+// Exit code 0 - ok.
+static int runStandby(const string& captureDir, const string& socketPath, int control, int ready, const vector<InputOrder>& orders)
+{
+  Exchange ex;
+  auto clients = connectClients(ex, 3);
+  Standby standby(ex, socketPath, captureDir);
+  standby.start();
+  if (1 != write(ready, "r", 1)) return 1;
+
+  char c = 0;
+  if (1 != read(control, &c, 1)) return 1;
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+  while (false == standby.primaryGone && chrono::steady_clock::now() < deadline) this_thread::sleep_for(chrono::milliseconds(1));
+  auto failover = chrono::steady_clock::now();
+  bool promoted = standby.promote();
+  cout << "standby promoted in " << chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - failover).count() << " us, "
+       << standby.caughtUp << " of " << standby.applied << " orders caught up from the capture" << endl;
+  if (false == standby.primaryGone || false == promoted || true == standby.failed) return 2;
+  if (orders.size() != standby.applied || 0 == standby.caughtUp || orders.size() != ex.engine.inputSeq) return 3;
+
+  // warm books, the same as the primary's
+  vector<Event> events;
+  auto collect = [&](const Event& e){ events.push_back(e); };
+  BacktestEngine<Book, decltype(collect)> replay(collect);
+  for (auto& o : orders) replay.placeOrder(o.instrument, o.side, o.trader, o.qty, o.type, o.displayQty);
+  for (char instrument : {'A', 'B'})
+  {
+    const Book& expected = replay.books[instrument];
+    const Book& book = ex.engine.books[instrument];
+    if (expected.outstandingQty != book.outstandingQty || expected.openedOrdersQty != book.openedOrdersQty ||
+        expected.hiddenQty != book.hiddenQty || expected.orders.size() != book.orders.size()) return 4;
+  }
+
+  // live: takes orders and notifies its own clients
+  Event event;
+  if (true == clients[0]->events.pop(event)) return 5;
+  ex.engine.q.push(InputOrder{'Z', 1, 5, Buy});
+  ex.engine.q.push(InputOrder{'Z', 2, 5, Sell});
+  ex.stop();
+  bool executed = false;
+  while (true == clients[0]->events.pop(event)) executed |= (Exec == event.type);
+  if (orders.size() + 2 != ex.engine.inputSeq) return 8;
+  return executed ? 0 : 6;
+}
+
+// The primary replicates orders [0, cut) to the standby process, the rest
+// only reaches its capture. Never inlined: the standby process is forked
+// without the primary's rings (megabytes) on its stack.
+__attribute__((noinline))
+static void runPrimary(const string& captureDir, const string& socketPath, int control, int ready, const vector<InputOrder>& orders, size_t cut)
+{
+  Exchange ex;
+  auto clients = connectClients(ex, 3);
+  unique_ptr<Capture> capture(new Capture(captureDir, 512));
+  unique_ptr<ReplicationSender> sender(new ReplicationSender(socketPath));
+  capture->attach(ex);
+  sender->attach(ex);
+  capture->start();
+  sender->start();
+  ex.start();
+
+  // no standby yet, only captured
+  for (size_t i = 0; i < 1000; i++) ex.engine.q.push(orders[i]);
+  while (1000 != sender->dropped) this_thread::yield();
+
+  char c = 0;
+  ASSERT_EQ (1, write(control, "g", 1));
+  ASSERT_EQ (1, read(ready, &c, 1));
+  this_thread::sleep_for(chrono::milliseconds(20));
+
+  for (size_t i = 1000; i < cut; i++)
+  {
+    ex.engine.q.push(orders[i]);
+    if (0 == i % 500) this_thread::sleep_for(chrono::milliseconds(5));
+  }
+  while (cut != sender->highWater) this_thread::yield();
+  ASSERT_TRUE (sender->waitAcked(cut, chrono::seconds(5)));
+  ASSERT_LT (0u, sender->sent);
+
+  // the link goes first, the primary keeps matching for a while
+  sender->stop();
+  for (size_t i = cut; i < orders.size(); i++) ex.engine.q.push(orders[i]);
+
+  // the primary dies
+  ex.stop();
+  capture->stop();
+  ASSERT_EQ (orders.size(), capture->inputsSeq);
+  ASSERT_EQ (1, write(control, "d", 1));
+}
+
+// The standby has to end up with all the orders of the primary.
+static void failover(size_t cut)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string captureDir = dir, socketPath = captureDir + "/standby.sock";
+  vector<InputOrder> orders = replicationFlow(4000);
+  int control[2], ready[2];
+  ASSERT_EQ (0, pipe(control));
+  ASSERT_EQ (0, pipe(ready));
+
+  // forked before any thread of this test is started
+  pid_t pid = fork();
+  ASSERT_LE (0, pid);
+  if (0 == pid)
+  {
+    close(control[1]);
+    close(ready[0]);
+    char c = 0;
+    int code = (1 == read(control[0], &c, 1)) ? runStandby(captureDir, socketPath, control[0], ready[1], orders) : 7;
+    _exit(code);
+  }
+  // the reads see the end of file when the other process is gone
+  close(control[0]);
+  close(ready[1]);
+
+  runPrimary(captureDir, socketPath, control[1], ready[0], orders, cut);
+
+  int status = 0;
+  ASSERT_EQ (pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE (WIFEXITED(status));
+  ASSERT_EQ (0, WEXITSTATUS(status));
+
+  for (auto name : {"inputs", "events"})
+  {
+    for (auto& path : captureSegments(captureDir, name)) unlink(path.c_str());
+  }
+  close(control[1]);
+  close(ready[0]);
+  rmdir(dir);
+}
+
+TEST(ReplicationTest, StandbyProcessCatchesUpAndTakesOver)
+{
+  failover(4000);
+}
+
+TEST(ReplicationTest, PromoteCatchesUpFromCaptureAfterCutOff)
+{
+  failover(3000);
+}
+
+TEST(ReplicationTest, PromoteRefusesWithMissingSequence)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string socketPath = string(dir) + "/standby.sock";
+  {
+    Exchange ex;
+    Standby standby(ex, socketPath, dir);
+    standby.start();
+
+    // seq 1 and 2 were never captured
+    ReplicationSender sender(socketPath);
+    ASSERT_TRUE (sender.connect());
+    ReplicationRecord records[] = {encodeRecord(SequencedInput{3, 0, InputOrder{'A', 1, 5, Buy}}), encodeRecord(SequencedInput{4, 0, InputOrder{'A', 2, 5, Sell}})};
+    ASSERT_EQ (ssize_t(sizeof(records)), write(sender.fd, records, sizeof(records)));
+    sender.disconnect();
+
+    // the standby hangs up by itself once it failed
+    while (2 != standby.missed) this_thread::sleep_for(chrono::milliseconds(1));
+    ASSERT_TRUE (standby.failed);
+    ASSERT_EQ (2u, standby.missed);
+    ASSERT_EQ (0u, standby.applied);
+    ASSERT_FALSE (standby.promote());
+  }
+  // the standby removed its socket
+  ASSERT_EQ (0, rmdir(dir));
+}
+
+TEST(ReplicationTest, StandbyKeepsReadingBehindAGap)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string socketPath = string(dir) + "/standby.sock";
+  {
+    Exchange ex;
+    Standby standby(ex, socketPath, dir);
+    standby.start();
+
+    // seq 1 is not captured yet, the records after it wait
+    ReplicationSender sender(socketPath);
+    ASSERT_TRUE (sender.connect());
+    ReplicationRecord first[] = {encodeRecord(SequencedInput{2, 0, InputOrder{'A', 2, 5, Sell}}), encodeRecord(SequencedInput{3, 0, InputOrder{'A', 3, 5, Buy}})};
+    ASSERT_EQ (ssize_t(sizeof(first)), write(sender.fd, first, sizeof(first)));
+    this_thread::sleep_for(chrono::milliseconds(50));
+    ReplicationRecord second = encodeRecord(SequencedInput{4, 0, InputOrder{'A', 4, 5, Sell}});
+    ASSERT_EQ (ssize_t(sizeof(second)), write(sender.fd, &second, sizeof(second)));
+    ASSERT_EQ (0u, standby.applied);
+
+    // the capture thread of the primary writes it late
+    {
+      SegmentWriter writer(dir, "inputs", InputsCapture, 100);
+      writer.append(1, 0, Regular, 'A', 1, 5, Buy, 0, UINT64_MAX);
+      writer.commit();
+    }
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+    while (sender.acked < 4 && chrono::steady_clock::now() < deadline) sender.readAcks();
+    ASSERT_EQ (4u, sender.acked);
+    ASSERT_EQ (4u, standby.applied);
+    ASSERT_EQ (1u, standby.caughtUp);
+    ASSERT_EQ (0u, standby.missed);
+    ASSERT_FALSE (standby.failed);
+    ASSERT_EQ (0u, ex.engine.books['A'].orders.size());
+    sender.disconnect();
+
+    for (auto& path : captureSegments(dir, "inputs")) unlink(path.c_str());
+  }
+  ASSERT_EQ (0, rmdir(dir));
+}
+
+TEST(ReplicationTest, StandbyAppliesSweepLargerThanEventsRing)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string socketPath = string(dir) + "/standby.sock";
+  {
+    Exchange ex;
+    Standby standby(ex, socketPath, dir);
+    standby.start();
+
+    // one sell sweeps more resting orders than the events ring holds
+    const uint64_t RESTING = 70000;
+    vector<ReplicationRecord> records;
+    for (uint64_t seq = 1; seq <= RESTING; seq++) records.push_back(encodeRecord(SequencedInput{seq, 0, InputOrder{'A', 1, 1, Buy}}));
+    records.push_back(encodeRecord(SequencedInput{RESTING + 1, 0, InputOrder{'A', 2, RESTING, Sell}}));
+
+    ReplicationSender sender(socketPath);
+    ASSERT_TRUE (sender.connect());
+    const char* p = reinterpret_cast<const char*>(records.data());
+    for (size_t left = records.size() * sizeof(ReplicationRecord); 0 != left; )
+    {
+      ssize_t n = write(sender.fd, p, left);
+      ASSERT_LT (0, n);
+      p += n;
+      left -= n;
+    }
+    sender.disconnect();
+
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(10);
+    while (RESTING + 1 != standby.applied && chrono::steady_clock::now() < deadline) this_thread::sleep_for(chrono::milliseconds(1));
+    ASSERT_EQ (RESTING + 1, standby.applied);
+    ASSERT_EQ (RESTING + 1, ex.engine.inputSeq);
+    ASSERT_TRUE (ex.engine.books['A'].orders.empty());
+    Event event;
+    ASSERT_FALSE (ex.notif.events.pop(event));
+    while (false == standby.primaryGone) this_thread::sleep_for(chrono::milliseconds(1));
+    ASSERT_TRUE (standby.promote());
+  }
+  ASSERT_EQ (0, rmdir(dir));
+}
+
+static bool waitPlaced(TradingTool& client, char instrument)
+{
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+  Event event;
+  while (chrono::steady_clock::now() < deadline)
+  {
+    if (false == client.events.pop(event)) this_thread::yield();
+    else if (OrderPlaced == event.type && instrument == event.instrument) return true;
+  }
+  return false;
+}
+
+TEST(ReplicationTest, SynchronousStandbyGatesEvents)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string socketPath = string(dir) + "/standby.sock";
+  vector<InputOrder> orders = replicationFlow(2000);
+
+  // trader 1 runs into its rate limit, on the clock of the primary on both
+  unique_ptr<Exchange> primary(new Exchange), replica(new Exchange);
+  for (Exchange* ex : {primary.get(), replica.get()}) ex->engine.risk.setLimits(1, TraderLimits{UINT32_MAX, UINT64_MAX, 100, 0});
+  unique_ptr<Standby> standby(new Standby(*replica, socketPath, dir));
+  standby->start();
+
+  auto clients = connectClients(*primary, 3);
+  unique_ptr<ReplicationSender> sender(new ReplicationSender(socketPath, true));
+  sender->attach(*primary);
+  sender->start();
+  while (false == sender->connected) this_thread::yield();
+  primary->start();
+
+  // the event of the last order is out only once the standby applied it
+  for (auto& o : orders) primary->engine.q.push(o);
+  primary->engine.q.push(InputOrder{'Z', 2, 5, Buy});
+  ASSERT_TRUE (waitPlaced(*clients[1], 'Z'));
+  ASSERT_EQ (orders.size() + 1, standby->applied);
+  ASSERT_EQ (0u, sender->dropped);
+  ASSERT_LT (0u, sender->held);
+  ASSERT_LT (0u, sender->heldNs);
+  cout << sender->held << " batches held up the primary for " << sender->heldNs / 1000 << " us" << endl;
+
+  Event event;
+  uint64_t rejected = 0;
+  while (true == clients[0]->events.pop(event)) rejected += (Rejected == event.type);
+  ASSERT_LT (0u, rejected);
+
+  for (char instrument : {'A', 'B', 'Z'})
+  {
+    const Book& expected = primary->engine.books[instrument];
+    const Book& book = replica->engine.books[instrument];
+    ASSERT_EQ (expected.outstandingQty, book.outstandingQty);
+    ASSERT_EQ (expected.openedOrdersQty, book.openedOrdersQty);
+    ASSERT_EQ (expected.hiddenQty, book.hiddenQty);
+    ASSERT_EQ (expected.orders.size(), book.orders.size());
+    for (uint16_t trader = 1; trader <= 3; trader++) ASSERT_EQ (primary->engine.risk.openQty(instrument, trader), replica->engine.risk.openQty(instrument, trader));
+  }
+
+  // without a standby the primary goes on alone
+  standby.reset();
+  primary->engine.q.push(InputOrder{'Y', 2, 5, Buy});
+  ASSERT_TRUE (waitPlaced(*clients[1], 'Y'));
+
+  primary->stop();
+  sender->stop();
+  ASSERT_EQ (0, rmdir(dir));
+}
+
+TEST(ReplicationTest, SynchronousPrimaryGoesOnPastAGap)
+{
+  char dir[] = "/tmp/exengine-replica-XXXXXX";
+  ASSERT_NE (nullptr, mkdtemp(dir));
+  string socketPath = string(dir) + "/standby.sock";
+
+  // no capture: the orders taken before the standby was there are lost to it
+  unique_ptr<Exchange> primary(new Exchange), replica(new Exchange);
+  auto clients = connectClients(*primary, 3);
+  unique_ptr<ReplicationSender> sender(new ReplicationSender(socketPath, true));
+  sender->attach(*primary);
+  sender->start();
+  primary->start();
+  primary->engine.q.push(InputOrder{'A', 1, 5, Buy});
+  ASSERT_TRUE (waitPlaced(*clients[0], 'A'));
+
+  unique_ptr<Standby> standby(new Standby(*replica, socketPath, dir));
+  standby->start();
+  while (false == sender->connected) this_thread::yield();
+
+  // the standby cannot catch up seq 1, the primary does not wait for it
+  for (char instrument : {'B', 'C', 'D'})
+  {
+    primary->engine.q.push(InputOrder{instrument, 2, 5, Buy});
+    ASSERT_TRUE (waitPlaced(*clients[1], instrument));
+  }
+  while (false == standby->failed) this_thread::sleep_for(chrono::milliseconds(1));
+
+  // hung up, later orders do not wait for the reconnects
+  primary->engine.q.push(InputOrder{'E', 3, 5, Buy});
+  ASSERT_TRUE (waitPlaced(*clients[2], 'E'));
+  ASSERT_EQ (0u, standby->applied);
+  ASSERT_LT (0u, standby->missed);
+  ASSERT_LT (0u, sender->timeouts);
+
+  primary->stop();
+  sender->stop();
+  standby.reset();
+  ASSERT_EQ (0, rmdir(dir));
+}
+
+TEST(TraderSchedulerTest, CallbacksInOrder)
+{
+  const uint16_t TRADERS = 10;
+  const uint32_t ORDERS = 100;
+  for (bool stealing : {false, true})
+  {
+    Exchange ex;
+    TraderScheduler scheduler(2, stealing);
+    scheduler.attach(ex);
+    vector<unique_ptr<TradingTool>> traders;
+    vector<vector<uint64_t>> calls(TRADERS + 1);
+    atomic<uint32_t> done(0);
+
+    // init (0) first, then the Cancelled events of its orders 1..100 in order:
+    // fill or kill orders with nothing to cross
+    for (uint16_t id = 1; id <= TRADERS; id++)
+    {
+      TradingTool* trader = new TradingTool(id);
+      trader->init = [&](TradingTool* me){
+        calls[me->id].push_back(0);
+        for (uint32_t qty = 1; qty <= ORDERS; qty++) me->q->push(InputOrder{'H', me->id, qty, Buy, FillOrKill});
+      };
+      trader->algo = [&](TradingTool* me, Event e){
+        calls[me->id].push_back((Cancelled == e.type) ? e.qty : UINT64_MAX);
+        if (ORDERS + 1 == calls[me->id].size()) done++;
+      };
+      trader->connectTo(ex);
+      scheduler.add(trader);
+      traders.emplace_back(trader);
+    }
+
+    ex.start();
+    scheduler.start();
+    auto deadline = chrono::steady_clock::now() + 1000ms;
+    while (TRADERS != done.load() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+    scheduler.stop();
+    ex.stop();
+
+    vector<uint64_t> expected;
+    for (uint64_t i = 0; i <= ORDERS; i++) expected.push_back(i);
+    for (uint16_t id = 1; id <= TRADERS; id++) ASSERT_EQ (expected, calls[id]) << id << (stealing ? " stealing" : "");
+  }
+}
+
+TEST(TraderSchedulerTest, IdleWorkersPark)
+{
+  Exchange ex;
+  TraderScheduler scheduler(2, true);
+  scheduler.attach(ex);
+  TradingTool trader(1);
+  atomic<uint32_t> events(0);
+  trader.algo = [&](TradingTool*, Event){ events++; };
+  trader.connectTo(ex);
+  scheduler.add(&trader);
+
+  ex.start();
+  scheduler.start();
+  auto deadline = chrono::steady_clock::now() + 1000ms;
+  while (2 != ex.notif.doorbell.sleepers.load() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  ASSERT_EQ (2u, ex.notif.doorbell.sleepers.load());
+
+  // the Notifier wakes them up
+  ex.engine.q.push(InputOrder{'H', 1, 10, Buy});
+  while (0 == events.load() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  ASSERT_EQ (1u, events.load());
+
+  // parked workers stop too
+  while (2 != ex.notif.doorbell.sleepers.load() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  scheduler.stop();
+  ex.stop();
+}
+
+TEST(TraderSchedulerTest, AttachOnlyBeforeStart)
+{
+  // the Notifier and the workers read the doorbell without a lock
+  Exchange ex;
+  TraderScheduler scheduler(2);
+  scheduler.start();
+  ASSERT_THROW (scheduler.attach(ex), logic_error);
+  scheduler.stop();
+
+  TraderScheduler late(2);
+  ex.start();
+  ASSERT_THROW (late.attach(ex), logic_error);
+  ex.stop();
+}
+
+TEST(TraderSchedulerTest, ThousandTradersOnFourWorkers_perf)
+{
+  Exchange ex;
+  TraderScheduler scheduler(4);
+  scheduler.attach(ex);
+  TraderPopulation population(ex, 1000, 20);
+
+  for (auto& trader : population.traders) scheduler.add(trader.get());
+
+  ex.start();
+  scheduler.start();
+  bool finished = population.wait(10000ms);
+  scheduler.stop();
+  ex.stop();
+
+  ASSERT_TRUE (finished);
+}
+
+TEST(TraderSchedulerTest, ThousandTradersThreadPerTrader_perf)
+{
+  Exchange ex;
+  TraderPopulation population(ex, 1000, 20);
+
+  ex.start();
+  for (auto& trader : population.traders) trader->start();
+  bool finished = population.wait(10000ms);
+  for (auto& trader : population.traders) trader->stop();
+  ex.stop();
+
+  ASSERT_TRUE (finished);
+}
+
+TEST(TraderPoolTest, AgentCallbacksNeverOverlap)
+{
+  Exchange ex;
+  TraderPool pool(ex, 4);
+  vector<atomic<int>> inside(101);
+  atomic<bool> overlapped(false);
+  atomic<uint32_t> finished(0);
+
+  for (uint16_t id = 1; id <= 100; id++)
+  {
+    auto init = [](TradingTool* me){
+      me->q->push(InputOrder{'H', me->id, 1, (me->id % 2) ? Sell : Buy});
+    };
+    auto algo = [&, count = uint32_t(0)](TradingTool* me, Event e) mutable {
+      if (0 != inside[me->id]++) overlapped = true;
+      if (Exec == e.type)
+      {
+        if (++count < 200) me->q->push(InputOrder{'H', me->id, 1, (me->id % 2) ? Sell : Buy});
+        else finished++;
+      }
+      inside[me->id]--;
+    };
+    pool.addAgent(id, init, algo);
+  }
+  for (auto& i : inside) i = 0;
+
+  ex.start();
+  pool.start();
+  auto deadline = chrono::steady_clock::now() + 2000ms;
+  while (finished.load() != 100 && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  pool.stop();
+  ex.stop();
+
+  ASSERT_EQ (100u, finished.load());
+  ASSERT_FALSE (overlapped.load());
+}
+
+TEST(TraderPoolTest, ExchangeOutlivesThePool)
+{
+  Exchange ex;
+  TradingTool trader(1);
+  trader.connectTo(ex);
+  {
+    TraderPool pool(ex, 2);
+    pool.start();
+    pool.stop();
+  }
+
+  // the Notifier rings its own doorbell, not the one of a freed scheduler
+  ex.start();
+  ex.engine.q.push(InputOrder{'H', 1, 10, Buy});
+  ASSERT_TRUE (waitPlaced(trader, 'H'));
+  ex.stop();
+}
+
+TEST(TraderPoolTest, IcebergTakerEndsWithItsLastSlice)
+{
+  Exchange ex;
+  TraderPool pool(ex, 2);
+  TradingTool seller(1);
+  seller.connectTo(ex);
+  pool.addTakers(2, 1, TakerParams{'I', Buy, 10, 2, Iceberg, 5});
+
+  ex.start();
+  pool.start();
+
+  // two slices of 5 execute the first order, it then sends the second one
+  for (int i = 0; i < 3; i++)
+  {
+    ex.engine.q.push(InputOrder{'I', 1, 5, Sell});
+    this_thread::sleep_for(10ms);
+    ASSERT_FALSE (pool.takersDone());
+  }
+  ex.engine.q.push(InputOrder{'I', 1, 5, Sell});
+  auto deadline = chrono::steady_clock::now() + 2000ms;
+  while (false == pool.takersDone() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  ASSERT_TRUE (pool.takersDone());
+  pool.stop();
+  ex.stop();
+}
+
+TEST(TraderPoolTest, TakersOfAClosedExchangeAreDone)
+{
+  Exchange ex;
+  TraderPool pool(ex, 2);
+  pool.addTakers(1, 10, TakerParams{'A', Buy, 10, 5, Regular});
+  pool.addMarketMakers(11, 2, MarketMakerParams{'B', Sell, 10, 3});
+
+  // every taker's first order and every quote is refused
+  ex.start();
+  ex.close();
+  pool.start();
+  auto deadline = chrono::steady_clock::now() + 2000ms;
+  while ((false == pool.takersDone() || 16 != pool.refused) && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  ASSERT_TRUE (pool.takersDone());
+  ASSERT_EQ (16u, pool.refused);
+  pool.stop();
+  ex.stop();
+}
+
+TEST(TraderPoolTest, MarketMakersAndTakers_perf)
+{
+  Exchange ex;
+  TraderPool pool(ex, 4);
+
+  pool.addMarketMakers(1, 100, MarketMakerParams{'A', Sell, 10, 5});
+  pool.addMarketMakers(101, 100, MarketMakerParams{'B', Buy, 10, 5});
+  pool.addTakers(1001, 400, TakerParams{'A', None, 25, 50, ImmediateOrCancel});
+  pool.addTakers(2001, 400, TakerParams{'B', Sell, 7, 50, FillOrKill});
+
+  ex.start();
+  pool.start();
+  auto deadline = chrono::steady_clock::now() + 10000ms;
+  while (false == pool.takersDone() && chrono::steady_clock::now() < deadline) this_thread::sleep_for(1ms);
+  pool.stop();
+  ex.stop();
+
+  ASSERT_TRUE (pool.takersDone());
+}
+
 //========================   MAIN MAIN  ==============================
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);